@@ -0,0 +1,274 @@
+########################################################################################################################################################################
+# Benchmark of the transmission (Transmission_final.C) and amplitude
+# (Histograms_AllRuns.py) analyses on synthetic runs (see Synthetic_runs.C),
+# without access to the real data.
+# The synthetic runs are written once in OUTPUT/Benchmark (kept for the next
+# benchmarks). For each number of runs, the pipelines are run in a separate
+# process with stage_timers = 1 and the benchmark reports the events/s, the
+# peak memory (RSS) of the process and the time spent in each stage: file
+# open, PKUP scan, index/join, event loop, histogram merge and output write.
+# The results are printed and saved in OUTPUT/Benchmark/benchmark.csv.
+# The number of runs is per set: the transmission sorts n Sin and n Sout runs,
+# the amplitude spectra are built for the n Sin runs.
+########################################################################################################################################################################
+
+# Example: python3 Benchmark.py --runs 1 10 100 --hits 1e6
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+import time
+
+DETECTORS = [1, 2, 3, 4, 7, 8]
+STAGES = ["file open", "PKUP scan", "index/join", "event loop",
+          "histogram merge", "output write"]
+FIRST_SOUT = 100001
+
+# Write the cmnd file of a benchmark: generator, Transmission_final.C and
+# Histograms_AllRuns.py keys, for the runs Sin and Sout
+
+
+def write_cmnd(path: str, data_prefix: str, args, Sin: list, Sout: list,
+               skim_dir: str = ""):
+
+    runs_in = ", ".join(str(run) for run in Sin)
+    runs_out = ", ".join(str(run) for run in Sout)
+    lines = [
+        "#benchmark input, written by Benchmark.py",
+        f"hits_per_run = {args.hits}",
+        f"bunches_per_run = {args.bunches}",
+        f"dedicated_fraction = {args.dedicated_fraction}",
+        "detectors = " + ", ".join(str(DET) for DET in DETECTORS),
+        f"sample_transmission = {args.sample_transmission}",
+        f"seed = {args.seed}",
+        f"prefix = {data_prefix}",
+        "suffix = .root",
+        f"skim_dir = {skim_dir}",
+        f"output_dir = {os.path.join(args.dir, 'Total')}",
+        "stage_timers = 1",
+        f"SIN = {runs_in}",
+        f"SOUT = {runs_out}",
+        f"Sin = {runs_in}",
+        f"Sout = {runs_out}",
+    ]
+    for DET in DETECTORS:
+        lines += [f"cut_a_{DET} = 5.0e+3", f"cal_{DET} = 0",
+                  f"cut_a_det{DET} = 5.0e+3",
+                  f"Sin_DET{DET} = {runs_in}", f"Sout_DET{DET} = {runs_out}"]
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+# The peak RSS of a command is read with getrusage(RUSAGE_CHILDREN) after
+# Popen.wait(). Its ru_maxrss is the largest of all the children waited so far,
+# not a per-child value, so the command is waited by a new python process
+# (where it is the only child) that writes the value to the file argv[1].
+RSS_WRAPPER = (
+    "import resource, subprocess, sys\n"
+    "code = subprocess.Popen(sys.argv[2:]).wait()\n"
+    "usage = resource.getrusage(resource.RUSAGE_CHILDREN)\n"
+    "with open(sys.argv[1], 'w') as f:\n"
+    "    f.write(str(usage.ru_maxrss))\n"
+    "sys.exit(code if code >= 0 else 128 - code)\n")
+
+# Run a command with its output in log_path. Returns the exit code, the wall
+# time (s) and the peak RSS of the process (MB)
+
+
+def run_measured(cmd: list, log_path: str):
+
+    rss_path = log_path + ".rss"
+    start = time.perf_counter()
+    with open(log_path, "w") as log:
+        p = subprocess.Popen([sys.executable, "-c", RSS_WRAPPER, rss_path] + cmd,
+                             stdout=log, stderr=subprocess.STDOUT)
+        code = p.wait()
+    wall = time.perf_counter() - start
+    rss = 0.
+    if os.path.exists(rss_path):
+        # ru_maxrss is in kB on Linux
+        with open(rss_path) as f:
+            rss = int(f.read()) / 1024.
+        os.remove(rss_path)
+    return (code, wall, rss)
+
+# Events, wall time of the analysis and stage times found in a log
+
+
+def parse_log(log_path: str):
+
+    result = {"events": 0, "analysis_s": None}
+    with open(log_path) as f:
+        for line in f:
+            m = re.match(r"Event loop \(.*\): (\d+) entries", line)
+            if m:
+                result["events"] = int(m.group(1))
+            m = re.match(r"Sorting wall time: (\S+) s", line)
+            if m:
+                result["analysis_s"] = float(m.group(1))
+            m = re.match(r"Amplitude spectra: (\d+) entries in (\S+) s", line)
+            if m:
+                result["events"] = int(m.group(1))
+                result["analysis_s"] = float(m.group(2))
+            m = re.match(r"Stage (.+): (\S+) s", line)
+            if m and m.group(1) in STAGES:
+                result[m.group(1)] = float(m.group(2))
+    return result
+
+
+def transmission_cmd(cmnd: str, args, legacy: bool):
+    call = f'Transmission_final.C({args.bins}, {"true" if legacy else "false"}, {args.jobs}, "{cmnd}")'
+    return ["root", "-l", "-b", "-q", call]
+
+
+def amplitude_cmd(cmnd: str, args):
+    code = ("import time, Histograms_AllRuns as h\n"
+            "start = time.perf_counter()\n"
+            f"runs, spectra = h.Spectra('Sin', {cmnd!r}, {args.amp_bins})\n"
+            "seconds = time.perf_counter() - start\n"
+            "print(f'Amplitude spectra: {int(spectra[\"entries\"].sum())} "
+            "entries in {seconds} s')\n")
+    return [sys.executable, "-c", code]
+
+
+def amplitude_available():
+    try:
+        import configreader_cpp
+        return True
+    except ImportError:
+        return False
+
+
+def main():
+
+    parser = argparse.ArgumentParser(
+        description="Benchmark of the analyses on synthetic runs")
+    parser.add_argument("--runs", type=int, nargs="+", default=[1, 10, 100],
+                        help="numbers of runs per set")
+    parser.add_argument("--hits", type=float, default=1e6,
+                        help="FC-U hits per run")
+    parser.add_argument("--bunches", type=int, default=1000,
+                        help="bunches per run")
+    parser.add_argument("--dedicated-fraction", type=float, default=0.5)
+    parser.add_argument("--sample-transmission", type=float, default=0.8)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--bins", type=int, default=200,
+                        help="bins per decade of the transmission")
+    parser.add_argument("--amp-bins", type=int, default=100,
+                        help="bins of the amplitude spectra")
+    parser.add_argument("--jobs", type=int, default=0,
+                        help="jobs of the analyses (0: one per core)")
+    parser.add_argument("--legacy", action="store_true",
+                        help="also run the friend-tree event loop")
+    parser.add_argument("--skims", action="store_true",
+                        help="also run the pipelines on skims")
+    parser.add_argument("--dir", default="./OUTPUT/Benchmark")
+    args = parser.parse_args()
+    args.hits = int(args.hits)
+
+    os.makedirs(os.path.join(args.dir, "logs"), exist_ok=True)
+    # the runs depend on the generator settings
+    data_dir = os.path.join(
+        args.dir, f"runs_{args.hits}hits_{args.bunches}bunches_"
+        f"{args.dedicated_fraction}ded_{args.sample_transmission}T_seed{args.seed}")
+    data_prefix = os.path.join(data_dir, "run")
+    n_max = max(args.runs)
+    Sin_all = list(range(1, n_max + 1))
+    Sout_all = list(range(FIRST_SOUT, FIRST_SOUT + n_max))
+
+    skim_dir = os.path.join(data_dir, "skims")
+
+    # synthetic runs (only the missing ones are written)
+    cmnd = os.path.join(args.dir, "generate.cmnd")
+    write_cmnd(cmnd, data_prefix, args, Sin_all, Sout_all, skim_dir)
+    print(f"Writing {2 * n_max} synthetic runs in {data_dir}")
+    code, wall, _ = run_measured(
+        ["root", "-l", "-b", "-q", f'Synthetic_runs.C("{cmnd}", {args.jobs})'],
+        os.path.join(args.dir, "logs", "generate.log"))
+    if code != 0:
+        sys.exit(f"ERROR: Synthetic_runs.C failed, see {args.dir}/logs/generate.log")
+    print(f"Synthetic runs ready ({wall:.1f} s)")
+
+    # the skims are built in advance, so that only their reading is measured
+    if args.skims:
+        code, wall, _ = run_measured(
+            ["root", "-l", "-b", "-q", f'Skim_runs.C("{cmnd}", {args.jobs})'],
+            os.path.join(args.dir, "logs", "skims.log"))
+        if code != 0:
+            sys.exit(f"ERROR: Skim_runs.C failed, see {args.dir}/logs/skims.log")
+        print(f"Skims ready ({wall:.1f} s)")
+
+    has_amplitude = amplitude_available()
+    if not has_amplitude:
+        print("configreader_cpp not found: the amplitude pipeline is skipped "
+              "(build the bindings with python setup.py build_ext --inplace)")
+
+    pipelines = [("transmission", False)]
+    if args.legacy:
+        pipelines.append(("transmission legacy", False))
+    if has_amplitude:
+        pipelines.append(("amplitude", False))
+    if args.skims:
+        pipelines += [(name, True) for name, skim in pipelines
+                      if name != "transmission legacy"]
+
+    rows = []
+    for n in args.runs:
+        for name, skim in pipelines:
+            label = name + (" skim" if skim else "")
+            tag = f"{label.replace(' ', '_')}_{n}runs"
+            cmnd = os.path.join(args.dir, f"{tag}.cmnd")
+            write_cmnd(cmnd, data_prefix, args, Sin_all[:n], Sout_all[:n],
+                       skim_dir if skim else "")
+            if name == "amplitude":
+                cmd = amplitude_cmd(cmnd, args)
+            else:
+                cmd = transmission_cmd(cmnd, args, name.endswith("legacy"))
+            log_path = os.path.join(args.dir, "logs", f"{tag}.log")
+
+            print(f"Running {label} on {n} runs per set")
+            code, wall, rss = run_measured(cmd, log_path)
+            if code != 0:
+                print(f"ERROR: {label} failed, see {log_path}")
+                continue
+            res = parse_log(log_path)
+            seconds = res["analysis_s"] or wall
+            row = {"pipeline": label, "runs": n, "events": res["events"],
+                   "analysis_s": seconds, "process_s": wall,
+                   "events_per_s": res["events"] / seconds if seconds > 0 else 0,
+                   "peak_rss_mb": rss}
+            for stage in STAGES:
+                row[stage] = res.get(stage, "")
+            rows.append(row)
+
+    if not rows:
+        sys.exit("ERROR: no benchmark completed")
+
+    print("------------------------------------------")
+    print(f"{'pipeline':<22}{'runs':>6}{'events':>12}{'events/s':>12}"
+          f"{'wall (s)':>10}{'RSS (MB)':>10}")
+    for row in rows:
+        print(f"{row['pipeline']:<22}{row['runs']:>6}{row['events']:>12}"
+              f"{row['events_per_s']:>12.3g}{row['analysis_s']:>10.2f}"
+              f"{row['peak_rss_mb']:>10.0f}")
+    print("Time per stage (s, summed over the jobs):")
+    print(f"{'pipeline':<22}{'runs':>6}" +
+          "".join(f"{stage:>17}" for stage in STAGES))
+    for row in rows:
+        print(f"{row['pipeline']:<22}{row['runs']:>6}" +
+              "".join(f"{row[stage]:>17.3f}" if row[stage] != "" else
+                      f"{'-':>17}" for stage in STAGES))
+    print("------------------------------------------")
+
+    csv_path = os.path.join(args.dir, "benchmark.csv")
+    with open(csv_path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0]))
+        writer.writeheader()
+        writer.writerows(rows)
+    print(f"Results saved in {csv_path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -23,7 +23,7 @@ import math
 
 
 import configreader_cpp as cr
-from Histograms_AllRuns import Histograms
+from Histograms_AllRuns import DETECTORS, Histograms
 
 
 def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
@@ -105,7 +105,7 @@ def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
 # Histo to extract error on efficiency
     min = np.mean(y_ratio)-(0.5e-13)
     max = np.mean(y_ratio)+(0.5e-13)
-    h_E1 = ROOT.TH1F("Efficiency histo 1", "Efficiency distribution detector " +
+    h_E1 = ROOT.TH1F(f"Efficiency histo 1 det{DET}", "Efficiency distribution detector " +
                      str(DET) + " - " + str(run_type)+"1", 50, min, max)
     h_E1.SetLineColor(ROOT.kBlue)
     for e in y_S1:
@@ -115,7 +115,7 @@ def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
     h_E1.GetXaxis().SetTitle("Efficiency (Counts / N protons)")
     h_E1.GetYaxis().SetTitle("Entries")
 
-    h_E2 = ROOT.TH1F("Efficiency histo 2", "Efficiency distribution detector " +
+    h_E2 = ROOT.TH1F(f"Efficiency histo 2 det{DET}", "Efficiency distribution detector " +
                      str(DET) + " - " + str(run_type)+"2", 50, min, max)
     h_E2.SetLineColor(ROOT.kGreen+2)
     for e2 in y_S2:
@@ -212,5 +212,7 @@ def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
 
 
 if __name__ == "__main__":
-    main(DET=2, run_type="Sout",
-         cmnd_name="./input_files/Histograms_AllRuns.cmnd", nbins=300)
+    # the spectra of all the detectors come from a single pass over the runs
+    for DET in DETECTORS:
+        main(DET=DET, run_type="Sout",
+             cmnd_name="./input_files/Histograms_AllRuns.cmnd", nbins=300)
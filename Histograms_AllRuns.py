@@ -7,6 +7,13 @@
 # The next function builds the dataframe for the detector of interest.
 # The following function reads the PKUP detector tree and calculates the pulse
 # intensity of each run, which will be used to normalize the histograms.
+# The function Spectra builds, in a single pass over each run, the amplitude
+# spectra of all the detectors (with and without cut), the position of the
+# maximum, the number of entries and the pulse intensity of each run, using the
+# C++ engine of the configreader_cpp module (analysis/AmplitudeSpectra.h).
+# If skim_dir is set in the cmnd file, the runs are read from their skims (see
+# RunSkim.py) instead of the full ROOT files. With stage_timers = 1 the time
+# spent in each stage of Spectra is printed.
 # The next function builds the amplitude histograms with cuts.It returns a
 # tuple with the list of all the amplitude histograms
 # (one for each run), the list of the position of the bin with the maximum amplitude,
@@ -26,10 +33,24 @@ from datetime import datetime
 import sys
 import os
 import ast
+import functools
 
 import configreader_cpp as cr
+from RunSkim import update_skim
 ROOT.ROOT.EnableImplicitMT()
 
+# detectors of the amplitude analyses and range of the amplitude histograms
+DETECTORS = [1, 2, 3, 4, 7, 8]
+AMP_MAX = 45.e+3
+
+# Print the time of each stage of Spectra, timed with the C++ stage timers
+# (analysis/StageTimers.h, None if disabled)
+def print_stages(stages):
+
+    if stages is not None:
+        print("Time per stage:")
+        print(stages, end="")
+
 
 def data(DET: int, run_type: str, cmnd_name: str):
 
@@ -88,12 +109,65 @@ def PulseInt(DET: int, run_type: str, cmnd_name: str):
         PI_TOT[k]=float(np.sum(arr, dtype=np.float64))
     return (PI_TOT)
 
+# Amplitude spectra of all the detectors for the runs of run_type, each run
+# being read once. Returns the list of runs and a dictionary of numpy arrays
+# with one row per run: "uncut" and "cut" spectra (run, detector, bin, with
+# underflow and overflow bins as in ROOT), "entries", "entries_cut" and
+# "max_bin" (run, detector), "pulse_intensity" (run).
+# The result is kept, so that all the detectors share the same pass.
+@functools.lru_cache(maxsize=None)
+def Spectra(run_type: str, cmnd_name: str, nbins: int):
+
+    cfg=cr.ConfigReader(cmnd_name)
+    skim_dir=cfg.get_string("skim_dir")
+    stages=cr.StageTimes() if cfg.get_int("stage_timers", 0) != 0 else None
+    cuts=[cfg.get_float(f"cut_a_det{DET}") for DET in DETECTORS]
+
+# runs of all the detectors
+    filelist=[]
+    runlist=[]
+    for DET in DETECTORS:
+        for file, run in zip(*data(DET, run_type, cmnd_name)):
+            if run not in runlist:
+                filelist.append(file)
+                runlist.append(run)
+
+    print(f"Building amplitude spectra of detectors {DETECTORS}")
+    print(f"Reading {run_type} runs: \n", runlist)
+
+    if skim_dir:
+        with cr.StageTimer(stages, cr.Stage.open):
+            paths=[update_skim(run, file, skim_dir)
+                   for run, file in zip(runlist, filelist)]
+        spectra=cr.amplitude_spectra(paths, DETECTORS, cuts, nbins, AMP_MAX,
+                                     stages=stages)
+        print_stages(stages)
+        return (runlist, spectra)
+
+    RUNS=[]
+    for file in filelist:
+        with cr.StageTimer(stages, cr.Stage.open):
+            df_fcu=ROOT.RDataFrame("FC-U", file)
+            df_pkup=ROOT.RDataFrame("PKUP", file)
+        with cr.StageTimer(stages, cr.Stage.pkup):
+            arr=df_pkup.AsNumpy(["PulseIntensity"])["PulseIntensity"]
+            PI=float(np.sum(arr, dtype=np.float64))
+        with cr.StageTimer(stages, cr.Stage.loop):
+            fcu=df_fcu.AsNumpy(["detn", "amp"])
+        RUNS.append(cr.amplitude_spectra_arrays(
+            fcu["detn"], fcu["amp"], PI, DETECTORS, cuts, nbins, AMP_MAX,
+            stages=stages))
+    with cr.StageTimer(stages, cr.Stage.merge):
+        spectra={key: np.concatenate([r[key] for r in RUNS]) for key in RUNS[0]}
+    print_stages(stages)
+    return (runlist, spectra)
+
 # Create the amplitude histograms
 def Histograms(DET: int, run_type: str, cmnd_name: str, nbins: int):
 
     runlist=data(DET, run_type, cmnd_name)[1]
-    DF_det=dataframe(DET, run_type, cmnd_name)
-    PI_TOT=PulseInt(DET, run_type, cmnd_name)
+    RUNS, spectra=Spectra(run_type, cmnd_name, nbins)
+    d=DETECTORS.index(DET)
 
     cfg=cr.ConfigReader(cmnd_name)
 
@@ -115,41 +189,34 @@ def Histograms(DET: int, run_type: str, cmnd_name: str, nbins: int):
     print("With amplitude threshold: ", int(cut_a))
     print(f"Processing {run_type} runs: \n", runlist)
 
-# define dictionaries to store the amplitude values
-    d_Amp={}
-    Amp={}
 # define lists to store the histograms,the number of entries and the x position of the maximum bin
 
     Histos_CUTamp=[]
     Entries=[]
     MAX_BIN=[]
+    PI_TOT={}
 
-    for i in range(0, len(DF_det)):  # loop over the datframes for the different runs
+    for i in range(0, len(runlist)):  # loop over the spectra of the different runs
 
-# For each run, I extract all the amplitudes from the corresponding dataframe and put them in a dictionary
-        d_Amp[i]=DF_det[i].AsNumpy(["amp"])
-        Amp[i]=d_Amp[i]["amp"]
-        Amplitude=np.array(Amp[i])  # convert the list into a numpy array
+        k=RUNS.index(runlist[i])
+        PI_TOT[i]=float(spectra["pulse_intensity"][k])
 
 # histogram with cut on amplitude
-        Amplitude_cut=Amplitude[Amplitude > cut_a]
         histo_cut=ROOT.TH1F(
-            f"Amplitude_histo_cut_{i}", f"Amplitudes detector {DET} with cut - {run_type}", nbins, 0, 45.e+3)
-        for j in Amplitude_cut:
-            histo_cut.Fill(j)
+            f"Amplitude_histo_cut_{DET}_{i}", f"Amplitudes detector {DET} with cut - {run_type}", nbins, 0, AMP_MAX)
+        histo_cut.SetContent(np.ascontiguousarray(spectra["cut"][k, d]))
+        histo_cut.SetEntries(int(spectra["entries_cut"][k, d]))
 
         histo_cut.GetXaxis().SetTitle("Amplitude (channels)")
         histo_cut.GetYaxis().SetTitle("Entries / N protons")
-        Entries.append(int(Amplitude_cut.size))
+        Entries.append(int(spectra["entries_cut"][k, d]))
 
         histo_cut.Scale(1/PI_TOT[i])
 
         Histos_CUTamp.append(histo_cut)
 
-# Get the position of the maximum bin and store it in a list
-        max_bin=histo_cut.GetMaximumBin()
-        x_max=histo_cut.GetBinCenter(max_bin)
-        MAX_BIN.append(x_max)
+# Position of the maximum bin, computed by the engine
+        MAX_BIN.append(float(spectra["max_bin"][k, d]))
 
     return (Histos_CUTamp, MAX_BIN, Entries, PI_TOT)
 
@@ -158,33 +225,28 @@ def Histograms(DET: int, run_type: str, cmnd_name: str, nbins: int):
 def Plot(DET: int, run_type: str, cmnd_name: str, nbins: int, first_run_plot: int, last_run_plot: int):
 
     runlist=data(DET, run_type, cmnd_name)[1]
-    DF_det=dataframe(DET, run_type, cmnd_name)
-    PI_TOT=PulseInt(DET, run_type, cmnd_name)
+    RUNS, spectra=Spectra(run_type, cmnd_name, nbins)
+    d=DETECTORS.index(DET)
 
     print("---------------------------------------------------------------------")
     print(
         f"Plotting full amplitude histograms of runs from {first_run_plot} to {last_run_plot-1}")
 
-    d_Amp = {}
-    Amp = {}
     Histos = []
 
-    for i in range(0, len(DF_det)):
-# For each run, extract all the amplitudes from the corresponding dataframe and put them in a dictionary
-        d_Amp[i] = DF_det[i].AsNumpy(["amp"])
-        Amp[i] = d_Amp[i]["amp"]
-        Amplitude = np.array(Amp[i])  # convert the list into a numpy array
+    for i in range(0, len(runlist)):
+        k = RUNS.index(runlist[i])
 
-# Define an histogram and fill it with the amplitudes
+# Define an histogram with the amplitude spectrum of the run
         histo = ROOT.TH1F(
-            f"Amplitude_histo_{i}", f"Amplitudes detector {DET} - {run_type}", nbins, 0, 45.e+3)
-        for x in Amplitude:
-            histo.Fill(x)
+            f"Amplitude_histo_{DET}_{i}", f"Amplitudes detector {DET} - {run_type}", nbins, 0, AMP_MAX)
+        histo.SetContent(np.ascontiguousarray(spectra["uncut"][k, d]))
+        histo.SetEntries(int(spectra["entries"][k, d]))
 
         histo.GetXaxis().SetTitle("Amplitude (channels)")
         histo.GetYaxis().SetTitle("Entries / N protons")
 
-        histo.Scale(1/PI_TOT[i])  # divide by proton number
+        histo.Scale(1/spectra["pulse_intensity"][k])  # divide by proton number
 
         Histos.append(histo)
 
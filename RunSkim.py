@@ -0,0 +1,100 @@
+########################################################################################################################################################################
+# Reader of the run skims written by Skim_runs.C (format in analysis/SkimFormat.h).
+# A skim holds, for each FC-U hit, detn, PSpulse, amp and tof - tflash (dt),
+# and the PKUP entries (BunchNumber, PSpulse, PulseIntensity, tflash).
+# The skim file is memory-mapped and its columns are returned as numpy arrays
+# pointing into the mapping, without copies.
+# The functions update_skim and load_skim rebuild the skim through PyROOT if it
+# is missing or if the size or modification time of the run file changed (see
+# CheckSkim in analysis/RunSkim.h).
+########################################################################################################################################################################
+
+import mmap
+import os
+import struct
+
+import numpy as np
+
+SKIM_MAGIC = b"NTOFSKIM"
+SKIM_VERSION = 1
+SKIM_HEADER = struct.Struct("<8sIiqqQQ8Q")
+
+# name, type and length (hits or PKUP entries) of each column, in file order
+SKIM_COLUMNS = [
+    ("detn", np.uint8, "hits"),
+    ("PSpulse", np.int8, "hits"),
+    ("amp", np.float32, "hits"),
+    ("dt", np.float64, "hits"),
+    ("pk_bunch", np.int32, "pkup"),
+    ("pk_PSpulse", np.int32, "pkup"),
+    ("pk_intensity", np.float32, "pkup"),
+    ("pk_tflash", np.float64, "pkup"),
+]
+
+_skim_declared = False
+
+
+def skim_path(skim_dir: str, run: int):
+    return os.path.join(skim_dir, f"run{run}.skim")
+
+# Map a skim file and return a dictionary with its header values and columns
+
+
+def read_skim(path: str):
+
+    with open(path, "rb") as f:
+        if os.fstat(f.fileno()).st_size < SKIM_HEADER.size:
+            raise ValueError(f"{path} is truncated (no skim header)")
+        mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    magic, version, run, source_size, source_mtime, n_hits, n_pkup, *offsets = \
+        SKIM_HEADER.unpack_from(mm, 0)
+    if magic != SKIM_MAGIC or version != SKIM_VERSION:
+        raise ValueError(f"{path} is not a skim file (version {SKIM_VERSION})")
+
+    # the columns must fit in the file, as checked by SkimFile::open
+    size = max(offset + np.dtype(dtype).itemsize *
+               (n_hits if length == "hits" else n_pkup)
+               for (name, dtype, length), offset in zip(SKIM_COLUMNS, offsets))
+    if size > len(mm):
+        raise ValueError(f"{path} is truncated ({len(mm)} bytes, {size} "
+                         "expected)")
+
+    skim = {"run": run, "source_size": source_size,
+            "source_mtime": source_mtime}
+    for (name, dtype, length), offset in zip(SKIM_COLUMNS, offsets):
+        count = n_hits if length == "hits" else n_pkup
+        if count == 0:
+            skim[name] = np.empty(0, dtype=dtype)
+        else:
+            skim[name] = np.frombuffer(
+                mm, dtype=dtype, count=count, offset=offset)
+    return skim
+
+# Build the skim of a run from the run file if missing or stale, and return
+# its path
+
+
+def update_skim(run: int, source: str, skim_dir: str):
+
+    global _skim_declared
+    import ROOT
+
+    if not _skim_declared:
+        header = os.path.join(os.path.dirname(
+            os.path.abspath(__file__)), "analysis", "RunSkim.h")
+        ROOT.gInterpreter.Declare(f'#include "{header}"')
+        _skim_declared = True
+
+    os.makedirs(skim_dir, exist_ok=True)
+    path = skim_path(skim_dir, run)
+    if not ROOT.UpdateSkim(source, run, path):
+        raise RuntimeError(f"cannot build skim {path} from {source}")
+    return path
+
+# Return the skim of a run, building it from the run file if missing or stale
+
+
+def load_skim(run: int, source: str, skim_dir: str):
+
+    return read_skim(update_skim(run, source, skim_dir))
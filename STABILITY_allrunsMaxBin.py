@@ -15,7 +15,7 @@ import numpy as np
 import math
 
 import configreader_cpp as cr
-from Histograms_AllRuns import Histograms
+from Histograms_AllRuns import DETECTORS, Histograms
 
 
 def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
@@ -96,4 +96,6 @@ def main(DET: int, run_type: str, cmnd_name: str, nbins: int):
 
 
 if __name__ == "__main__":
-    main(2, "Sin", "./input_files/Histograms_AllRuns.cmnd", 150)
+    # the spectra of all the detectors come from a single pass over the runs
+    for DET in DETECTORS:
+        main(DET, "Sin", "./input_files/Histograms_AllRuns.cmnd", 150)
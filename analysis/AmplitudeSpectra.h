@@ -0,0 +1,193 @@
+#ifndef AMPLITUDESPECTRA_H
+#define AMPLITUDESPECTRA_H
+
+// Amplitude spectra of all the detectors of a run, built in a single pass over
+// its FC-U hits (used by Histograms_AllRuns.py through the configreader_cpp
+// module).
+// For each detector two spectra are filled: all the amplitudes (uncut) and the
+// amplitudes above the detector threshold (cut). The spectra have the layout of
+// a ROOT TH1 with nbins fixed bins in [0, amp_max): nbins + 2 values, 0 being
+// the underflow and nbins + 1 the overflow, and the same bin assignment as
+// TAxis::FindFixBin, so they can be copied into a TH1 with SetContent.
+// The stages (skim open, pulse intensity sum, fill, merge of the chunks) are
+// timed with the stage timers of the transmission (StageTimers.h) when a
+// StageTimes is given.
+// This header does not depend on ROOT.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "RunScheduler.h"
+#include "SkimFormat.h"
+#include "StageTimers.h"
+
+const int kAmpMaxDetn = 256;
+const size_t kAmpBatch = 4096;
+
+// binning and detectors shared by all the runs
+struct AmplitudeBinning {
+  int nbins;
+  double amp_min = 0.;
+  double amp_max;
+  std::vector<int> detectors;
+  std::vector<float> cuts;       // threshold of each detector
+  int slot[kAmpMaxDetn];         // detector index of each detn, -1 if unused
+
+  AmplitudeBinning(int nbins, double amp_max, const std::vector<int> &detectors,
+                   const std::vector<float> &cuts)
+      : nbins(nbins), amp_max(amp_max), detectors(detectors), cuts(cuts) {
+    std::fill(slot, slot + kAmpMaxDetn, -1);
+    for (size_t d = 0; d < detectors.size(); ++d)
+      if (detectors[d] >= 0 && detectors[d] < kAmpMaxDetn)
+        slot[detectors[d]] = d;
+  }
+
+  int ndet() const { return detectors.size(); }
+  int size() const { return nbins + 2; } // bins of one spectrum
+  double center(int bin) const {
+    double width = (amp_max - amp_min) / nbins;
+    return amp_min + (bin - 1) * width + 0.5 * width;
+  }
+};
+
+// results of one run, pointing into caller-owned arrays
+struct AmplitudeRun {
+  double *uncut = nullptr;          // [ndet][nbins + 2]
+  double *cut = nullptr;            // [ndet][nbins + 2]
+  int64_t *entries = nullptr;       // [ndet] hits of the detector
+  int64_t *entries_cut = nullptr;   // [ndet] hits above the threshold
+  double *max_bin = nullptr;        // [ndet] center of the max bin (cut)
+  double *pulse_intensity = nullptr; // sum of the PKUP PulseIntensity
+};
+
+// Add the hits [begin, end) to the spectra uncut and cut ([ndet][nbins + 2]).
+// Bins are computed for a batch of hits in a loop without branches, which the
+// compiler vectorizes, and then added to the spectra.
+template <class D>
+inline void FillAmplitudes(const AmplitudeBinning &ab, const D *detn,
+                           const float *amp, size_t begin, size_t end,
+                           double *uncut, double *cut) {
+  const int nb = ab.size();
+  const double width = ab.amp_max - ab.amp_min;
+  int32_t index[kAmpBatch];
+  float threshold[kAmpBatch];
+
+  for (size_t start = begin; start < end; start += kAmpBatch) {
+    size_t len = std::min(kAmpBatch, end - start);
+    const float *a = amp + start;
+
+    for (size_t i = 0; i < len; ++i) {
+      int det = (int)detn[start + i];
+      int s = (det >= 0 && det < kAmpMaxDetn) ? ab.slot[det] : -1;
+      threshold[i] = s >= 0 ? ab.cuts[s] : 0.f;
+      index[i] = s * nb;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+      double x = a[i];
+      // same as TAxis::FindFixBin, NaN goes to the overflow
+      double u = ab.nbins * (x - ab.amp_min) / width;
+      u = x < ab.amp_min ? -1. : u;
+      u = x < ab.amp_max ? u : (double)ab.nbins;
+      index[i] += 1 + (int)u;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+      if (index[i] < 0)
+        continue;
+      uncut[index[i]] += 1;
+      if (a[i] > threshold[i])
+        cut[index[i]] += 1;
+    }
+  }
+}
+
+// entries and position of the maximum of the cut spectra, as TH1::GetMaximumBin
+// (first maximum, underflow and overflow excluded)
+inline void FinishAmplitudes(const AmplitudeBinning &ab,
+                             const AmplitudeRun &out) {
+  const int nb = ab.size();
+  for (int d = 0; d < ab.ndet(); ++d) {
+    const double *u = out.uncut + d * nb;
+    const double *c = out.cut + d * nb;
+    double n = 0, n_cut = 0;
+    for (int i = 0; i < nb; ++i) {
+      n += u[i];
+      n_cut += c[i];
+    }
+    out.entries[d] = (int64_t)n;
+    out.entries_cut[d] = (int64_t)n_cut;
+
+    int max = 1;
+    for (int i = 2; i <= ab.nbins; ++i)
+      if (c[i] > c[max])
+        max = i;
+    out.max_bin[d] = ab.center(max);
+  }
+}
+
+// Spectra of the n hits of a run, split in jobs chunks filled in parallel.
+// Each chunk has its own spectra, summed in chunk order.
+template <class D>
+inline void AmplitudeSpectra(const AmplitudeBinning &ab, const D *detn,
+                             const float *amp, size_t n, int jobs,
+                             const AmplitudeRun &out,
+                             StageTimes *stages = nullptr) {
+  const size_t size = (size_t)ab.ndet() * ab.size();
+  int n_chunks = NumberOfJobs(jobs, std::max<size_t>(1, n / (16 * kAmpBatch)));
+
+  StageTimer loop_timer(stages, kStageLoop);
+  if (n_chunks == 1) {
+    FillAmplitudes(ab, detn, amp, 0, n, out.uncut, out.cut);
+    loop_timer.stop();
+  } else {
+    std::vector<std::vector<double>> uncut(n_chunks), cut(n_chunks);
+    size_t chunk = (n + n_chunks - 1) / n_chunks;
+    RunPool(n_chunks, n_chunks, [&](size_t c, int) {
+      uncut[c].assign(size, 0.);
+      cut[c].assign(size, 0.);
+      size_t begin = std::min(n, c * chunk);
+      size_t end = std::min(n, begin + chunk);
+      FillAmplitudes(ab, detn, amp, begin, end, uncut[c].data(),
+                     cut[c].data());
+    });
+    loop_timer.stop();
+    StageTimer merge_timer(stages, kStageMerge);
+    for (int c = 0; c < n_chunks; ++c) {
+      for (size_t i = 0; i < size; ++i) {
+        out.uncut[i] += uncut[c][i];
+        out.cut[i] += cut[c][i];
+      }
+    }
+  }
+  FinishAmplitudes(ab, out);
+}
+
+// Spectra and pulse intensity of a run read from its skim
+inline bool AmplitudeSpectraSkim(const AmplitudeBinning &ab,
+                                 const std::string &skim_path, int jobs,
+                                 const AmplitudeRun &out, std::string &error,
+                                 StageTimes *stages = nullptr) {
+  StageTimer open_timer(stages, kStageOpen);
+  SkimFile skim;
+  if (!skim.open(skim_path)) {
+    error = "cannot open skim " + skim_path;
+    return false;
+  }
+  const SkimHeader &h = skim.header();
+  open_timer.stop();
+
+  AmplitudeSpectra(ab, skim.detn(), skim.amp(), h.n_hits, jobs, out, stages);
+
+  StageTimer pkup_timer(stages, kStagePkup);
+  const float *intensity = skim.pk_intensity();
+  double pi = 0;
+  for (uint64_t i = 0; i < h.n_pkup; ++i)
+    pi += intensity[i];
+  *out.pulse_intensity = pi;
+  return true;
+}
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef CROSSSECTION_H
+#define CROSSSECTION_H
+
+// Conversion of the total transmission from the tof to the energy domain and
+// total cross section, with the chi-square against reference data (ORELA,
+// input_files/JHarvey.dat). A grid of flight paths L, time offsets t0 and
+// areal densities is evaluated in one call, in parallel over the grid points
+// (used by tof_to_E.C and FlightPath_scan.C).
+// The tof axis is ToF - Tpkup + Delta (ns): the neutron time of flight is
+// tof - t0. Energies are relativistic kinetic energies in eV.
+// This header does not depend on ROOT.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "RunScheduler.h"
+
+const double kNeutronMass = 939.56542052e6; // eV
+const double kSpeedOfLight = 0.299792458;   // m/ns
+
+// kinetic energy (eV) of a neutron with flight time tof - t0 (ns) over L (m),
+// NaN if the neutron would be faster than light
+inline double TofToEnergy(double tof, double L, double t0) {
+  double beta = L / ((tof - t0) * kSpeedOfLight);
+  double b2 = beta * beta;
+  if (!(beta > 0 && b2 < 1))
+    return std::numeric_limits<double>::quiet_NaN();
+  // gamma - 1 = beta^2 gamma^2 / (gamma + 1), without cancellation at low beta
+  double gamma = 1 / std::sqrt(1 - b2);
+  return kNeutronMass * b2 * gamma * gamma / (gamma + 1);
+}
+
+// tof (ns) of a neutron of kinetic energy E (eV) over L (m)
+inline double EnergyToTof(double E, double L, double t0) {
+  double gamma = 1 + E / kNeutronMass;
+  double beta = std::sqrt(1 - 1 / (gamma * gamma));
+  return t0 + L / (beta * kSpeedOfLight);
+}
+
+// transmission histogram in the tof domain (bins in increasing tof)
+struct TransmissionSpectrum {
+  std::vector<double> tof_edges; // nbins + 1
+  std::vector<double> T, T_error; // nbins
+};
+
+// grid point of a scan
+struct ScanPoint {
+  double L = 0;
+  double t0 = 0;
+  double density = 0; // areal density (atoms/barn)
+};
+
+// cross section at one grid point, in bins of increasing energy
+struct CrossSectionResult {
+  ScanPoint point;
+  std::vector<double> E_edges;      // nbins + 1
+  std::vector<double> sigma, error; // barn
+  std::vector<int> tof_bin;         // tof bin of each energy bin
+  double chi2 = 0;
+  int ndf = 0; // bins compared with the reference
+};
+
+// Reference cross section (energy, sigma, error per line, '#' comments), with
+// an index on a uniform log(E) grid giving for each cell the first point of
+// the cell, so that the points of an energy range are found without a search.
+class ReferenceData {
+public:
+  std::vector<double> E, sigma, error;
+
+  bool load(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+      return false;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      double e, s, ds;
+      if (line[0] == '#' || sscanf(line, "%lg %lg %lg", &e, &s, &ds) != 3)
+        continue;
+      E.push_back(e);
+      sigma.push_back(s);
+      error.push_back(ds);
+    }
+    fclose(f);
+    if (E.size() < 2 || !std::is_sorted(E.begin(), E.end()) || E[0] <= 0)
+      return false;
+    build_index();
+    return true;
+  }
+
+  double min() const { return E.front(); }
+  double max() const { return E.back(); }
+
+  // first point with energy >= e
+  size_t lower_bound(double e) const {
+    if (!(e > E.front()))
+      return 0;
+    if (e > E.back())
+      return E.size();
+    size_t k = index[cell(e)];
+    while (E[k] < e)
+      ++k;
+    return k;
+  }
+
+  // Reference over the energy bin [lo, hi): mean of the points in the bin, or
+  // linear interpolation at the bin center if the bin holds no point.
+  // Returns false outside the reference range.
+  bool bin_value(double lo, double hi, double &value, double &value_error) const {
+    if (lo < E.front() || hi > E.back())
+      return false;
+    size_t first = lower_bound(lo), last = lower_bound(hi);
+    if (last > first) {
+      double sum = 0, sum_err2 = 0;
+      for (size_t k = first; k < last; ++k) {
+        sum += sigma[k];
+        sum_err2 += error[k] * error[k];
+      }
+      double n = last - first;
+      value = sum / n;
+      value_error = std::sqrt(sum_err2) / n;
+      return true;
+    }
+    double e = std::sqrt(lo * hi);
+    size_t k = std::max<size_t>(1, lower_bound(e));
+    double w = (e - E[k - 1]) / (E[k] - E[k - 1]);
+    value = sigma[k - 1] + w * (sigma[k] - sigma[k - 1]);
+    value_error = error[k - 1] + w * (error[k] - error[k - 1]);
+    return true;
+  }
+
+private:
+  static constexpr int kCells = 4096;
+  double log_min = 0, cell_width = 1;
+  std::vector<size_t> index; // first point of each cell
+
+  int cell(double e) const {
+    int c = (int)((std::log(e) - log_min) / cell_width);
+    return std::min(std::max(c, 0), kCells - 1);
+  }
+
+  void build_index() {
+    log_min = std::log(E.front());
+    cell_width = (std::log(E.back()) - log_min) / kCells;
+    index.assign(kCells, 0);
+    size_t k = 0;
+    for (int c = 0; c < kCells; ++c) {
+      // start one point early: the cell edges are rounded
+      while (k + 1 < E.size() && cell(E[k + 1]) < c)
+        ++k;
+      index[c] = k;
+    }
+  }
+};
+
+// Cross section -ln(T) / density for one grid point, and its chi-square against
+// the reference in [E_min, E_max] (0: whole reference range). Bins with T <= 0
+// get cross section 0 and error 0.1 barn and are not compared.
+inline CrossSectionResult CrossSection(const TransmissionSpectrum &spectrum,
+                                       const ScanPoint &point,
+                                       const ReferenceData *reference,
+                                       double E_min = 0, double E_max = 0) {
+  CrossSectionResult res;
+  res.point = point;
+  int nbins = spectrum.T.size();
+
+  // energy of each tof edge, only the bins slower than light are kept
+  std::vector<double> E(nbins + 1);
+  for (int i = 0; i <= nbins; ++i)
+    E[i] = TofToEnergy(spectrum.tof_edges[i], point.L, point.t0);
+  int first = 0;
+  while (first < nbins && !(E[first] >= 0))
+    ++first;
+  int n = nbins - first;
+  if (n <= 0)
+    return res;
+
+  res.E_edges.resize(n + 1);
+  res.sigma.resize(n);
+  res.error.resize(n);
+  res.tof_bin.resize(n);
+  for (int j = 0; j <= n; ++j)
+    res.E_edges[j] = E[nbins - j];
+
+  for (int j = 0; j < n; ++j) {
+    int i = nbins - 1 - j;
+    double T = spectrum.T[i];
+    res.tof_bin[j] = i;
+    if (T > 0) {
+      res.sigma[j] = -std::log(T) / point.density;
+      res.error[j] = spectrum.T_error[i] / (T * point.density);
+    } else {
+      res.sigma[j] = 0;
+      res.error[j] = 0.1;
+    }
+  }
+
+  if (!reference)
+    return res;
+  double lo_limit = E_min > 0 ? E_min : reference->min();
+  double hi_limit = E_max > 0 ? E_max : reference->max();
+  for (int j = 0; j < n; ++j) {
+    double lo = res.E_edges[j], hi = res.E_edges[j + 1];
+    double ref, ref_error;
+    if (lo < lo_limit || hi > hi_limit || spectrum.T[res.tof_bin[j]] <= 0 ||
+        !reference->bin_value(lo, hi, ref, ref_error))
+      continue;
+    double var = res.error[j] * res.error[j] + ref_error * ref_error;
+    if (!(var > 0))
+      continue;
+    double diff = res.sigma[j] - ref;
+    res.chi2 += diff * diff / var;
+    res.ndf++;
+  }
+  return res;
+}
+
+// Cross section and chi-square of every grid point, computed in parallel with
+// `jobs` workers (<= 0: one per core). With keep_cross_sections = false only
+// the chi-square of each point is kept, so that large grids fit in memory.
+inline std::vector<CrossSectionResult>
+CrossSectionScan(const TransmissionSpectrum &spectrum,
+                 const std::vector<ScanPoint> &points,
+                 const ReferenceData &reference, double E_min, double E_max,
+                 int jobs = 0, bool keep_cross_sections = true) {
+  std::vector<CrossSectionResult> results(points.size());
+  RunPool(points.size(), NumberOfJobs(jobs, points.size()),
+          [&](size_t p, int) {
+            CrossSectionResult res =
+                CrossSection(spectrum, points[p], &reference, E_min, E_max);
+            if (keep_cross_sections) {
+              results[p] = std::move(res);
+              return;
+            }
+            results[p].point = res.point;
+            results[p].chi2 = res.chi2;
+            results[p].ndf = res.ndf;
+          });
+  return results;
+}
+
+// values from min to max in steps points (min only if steps <= 1)
+inline std::vector<double> ScanValues(double min, double max, int steps) {
+  std::vector<double> v;
+  if (steps <= 1)
+    return {min};
+  for (int i = 0; i < steps; ++i)
+    v.push_back(min + (max - min) * i / (steps - 1));
+  return v;
+}
+
+#endif
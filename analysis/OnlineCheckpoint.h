@@ -0,0 +1,358 @@
+#ifndef ONLINECHECKPOINT_H
+#define ONLINECHECKPOINT_H
+
+// Checkpoint of the online transmission (Transmission_online.C).
+// For each set, detector and bunch type it keeps the sum of the fine tof
+// histograms (see PartialStore.h) of the runs added so far, and for each run
+// the set and the detectors it was added to, with the fingerprint (entries,
+// sum of the contents, pulse intensity) of the partial result added to each
+// detector and bunch type.
+// A run is added, moved or removed by adding or subtracting its partial
+// result for the detectors that changed, so an update costs only the runs that
+// changed, whatever the number of runs already in. Bin contents and squared
+// weights are integer counts: subtracting a run gives back exactly the sums
+// without it, provided the partial result is the one that was added. If the
+// partial result of a run changed since (e.g. sorted again from a new file),
+// its fingerprint differs: the detector is not subtracted but rebuilt from the
+// partial results of its runs (rebuild()). The pulse intensity sums are
+// recomputed from the runs at each update.
+
+#include "TFile.h"
+#include "TH1D.h"
+#include "TVectorD.h"
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PartialStore.h"
+#include "TransmissionEngine.h"
+#include "TransmissionOutput.h"
+
+// fingerprint of the partial result added for one detector and bunch type
+struct PartialPrint {
+  double entries = 0;
+  double counts = 0;
+  double PI = 0;
+
+  PartialPrint() = default;
+  PartialPrint(const TH1D *h, double pi)
+      : entries(h->GetEntries()), counts(PartialCounts(h)), PI(pi) {}
+
+  bool operator==(const PartialPrint &o) const {
+    return entries == o.entries && counts == o.counts && PI == o.PI;
+  }
+};
+
+// set and detectors a run is added to, and the fingerprints of what was added
+struct CheckpointEntry {
+  int set = -1; // -1: not added
+  bool det[kNDetectors] = {};
+  PartialPrint print[kNDetectors][kNBunchTypes];
+
+  bool in(int s, int d) const { return set == s && det[d]; }
+
+  bool any() const {
+    for (int d = 0; d < kNDetectors; ++d)
+      if (in(set, d))
+        return true;
+    return false;
+  }
+
+  bool same(const CheckpointEntry &o) const {
+    for (int s = 0; s < kNSets; ++s)
+      for (int d = 0; d < kNDetectors; ++d)
+        if (in(s, d) != o.in(s, d))
+          return false;
+    return true;
+  }
+};
+
+class OnlineCheckpoint {
+public:
+  PartialParams params;
+  TH1D *H[kNSets][kNDetectors][kNBunchTypes];
+  std::map<int, CheckpointEntry> runs; // runs added, by run number
+
+  explicit OnlineCheckpoint(const PartialParams &params_) : params(params_) {
+    std::vector<double> xbins_fine = TofBinning(params.bins_per_decade);
+    for (int s = 0; s < kNSets; ++s) {
+      for (int d = 0; d < kNDetectors; ++d) {
+        for (int b = 0; b < kNBunchTypes; ++b) {
+          H[s][d][b] = new TH1D(HistoName(s, d, b).c_str(), "",
+                                xbins_fine.size() - 1, xbins_fine.data());
+          H[s][d][b]->SetDirectory(nullptr);
+          H[s][d][b]->Sumw2();
+        }
+      }
+    }
+  }
+
+  ~OnlineCheckpoint() {
+    for (int s = 0; s < kNSets; ++s)
+      for (int d = 0; d < kNDetectors; ++d)
+        for (int b = 0; b < kNBunchTypes; ++b)
+          delete H[s][d][b];
+  }
+
+  OnlineCheckpoint(const OnlineCheckpoint &) = delete;
+  OnlineCheckpoint &operator=(const OnlineCheckpoint &) = delete;
+
+  static std::string HistoName(int s, int d, int b) {
+    char name[64];
+    snprintf(name, sizeof(name), "online %s %d %s", kSetNames[s],
+             kDetectors[d], kBunchNames[b]);
+    return name;
+  }
+
+  // Read a checkpoint written by save(). Returns false, with the reason in
+  // error, if it is missing or was built with other bins, cuts or
+  // calibrations; the checkpoint is then left empty.
+  bool load(const std::string &path, std::string &error) {
+    TFile *f = TFile::Open(path.c_str(), "READ");
+    if (!f || f->IsZombie()) {
+      delete f;
+      error = "missing";
+      return false;
+    }
+
+    bool ok = true;
+    TVectorD *v_params = (TVectorD *)f->Get("params");
+    TVectorD *v_runs = (TVectorD *)f->Get("runs");
+    TVectorD *v_version = (TVectorD *)f->Get("version");
+    TVectorD expected = params.to_vector();
+    if (!v_version || v_version->GetNrows() != 1 ||
+        (*v_version)[0] != kCheckpointVersion) {
+      error = "written by another version";
+      ok = false;
+    } else if (!v_params || !v_runs ||
+               v_params->GetNrows() != expected.GetNrows() ||
+               v_runs->GetNrows() % kRunColumns != 0) {
+      error = "invalid file";
+      ok = false;
+    } else {
+      for (int i = 0; i < expected.GetNrows(); ++i) {
+        if ((*v_params)[i] != expected[i]) {
+          error = "built with different bins/cuts/calibrations";
+          ok = false;
+          break;
+        }
+      }
+    }
+
+    for (int s = 0; ok && s < kNSets; ++s) {
+      for (int d = 0; ok && d < kNDetectors; ++d) {
+        for (int b = 0; b < kNBunchTypes; ++b) {
+          TH1D *h = (TH1D *)f->Get(HistoName(s, d, b).c_str());
+          if (!h || h->GetNbinsX() != H[s][d][b]->GetNbinsX()) {
+            error = "invalid file";
+            ok = false;
+            delete h;
+            break;
+          }
+          H[s][d][b]->Reset();
+          AddPartial(H[s][d][b], h, 1);
+          delete h;
+        }
+      }
+    }
+
+    runs.clear();
+    if (ok) {
+      for (int i = 0; i < v_runs->GetNrows(); i += kRunColumns) {
+        CheckpointEntry e;
+        int run = (*v_runs)[i];
+        e.set = (*v_runs)[i + 1];
+        int mask = (*v_runs)[i + 2];
+        for (int d = 0; d < kNDetectors; ++d) {
+          e.det[d] = (mask >> d) & 1;
+          for (int b = 0; b < kNBunchTypes; ++b) {
+            int k = i + 3 + 3 * (d * kNBunchTypes + b);
+            e.print[d][b].entries = (*v_runs)[k];
+            e.print[d][b].counts = (*v_runs)[k + 1];
+            e.print[d][b].PI = (*v_runs)[k + 2];
+          }
+        }
+        runs[run] = e;
+      }
+    } else {
+      clear();
+    }
+
+    delete v_params;
+    delete v_runs;
+    delete v_version;
+    delete f;
+    return ok;
+  }
+
+  // write the checkpoint to a temporary file renamed at the end, so that an
+  // interrupted update leaves the previous checkpoint
+  bool save(const std::string &path) const {
+    std::string tmp = path + ".part";
+    TFile *f = TFile::Open(tmp.c_str(), "RECREATE");
+    if (!f || f->IsZombie()) {
+      delete f;
+      return false;
+    }
+
+    for (int s = 0; s < kNSets; ++s)
+      for (int d = 0; d < kNDetectors; ++d)
+        for (int b = 0; b < kNBunchTypes; ++b)
+          f->WriteTObject(H[s][d][b], HistoName(s, d, b).c_str());
+
+    TVectorD v_runs(kRunColumns * runs.size());
+    int i = 0;
+    for (const auto &r : runs) {
+      int mask = 0;
+      for (int d = 0; d < kNDetectors; ++d)
+        mask |= r.second.det[d] << d;
+      v_runs[i] = r.first;
+      v_runs[i + 1] = r.second.set;
+      v_runs[i + 2] = mask;
+      for (int d = 0; d < kNDetectors; ++d) {
+        for (int b = 0; b < kNBunchTypes; ++b) {
+          int k = i + 3 + 3 * (d * kNBunchTypes + b);
+          v_runs[k] = r.second.print[d][b].entries;
+          v_runs[k + 1] = r.second.print[d][b].counts;
+          v_runs[k + 2] = r.second.print[d][b].PI;
+        }
+      }
+      i += kRunColumns;
+    }
+    TVectorD v_params = params.to_vector();
+    TVectorD v_version(1);
+    v_version[0] = kCheckpointVersion;
+    f->WriteTObject(&v_params, "params");
+    f->WriteTObject(&v_runs, "runs");
+    f->WriteTObject(&v_version, "version");
+    f->Close();
+    delete f;
+
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  void clear() {
+    runs.clear();
+    for (int s = 0; s < kNSets; ++s)
+      for (int d = 0; d < kNDetectors; ++d)
+        for (int b = 0; b < kNBunchTypes; ++b)
+          H[s][d][b]->Reset();
+  }
+
+  // current entry of a run (set -1 if not added)
+  CheckpointEntry entry(int run) const {
+    auto it = runs.find(run);
+    return it == runs.end() ? CheckpointEntry() : it->second;
+  }
+
+  // Bring a run from its current entry to target, with its partial histograms
+  // P and pulse intensities PI: P is added to the sets/detectors it enters and
+  // subtracted from the ones it leaves. A detector is only subtracted if P is
+  // the partial result it was added with; otherwise it is left as it is and
+  // flagged in stale, to be rebuilt. Returns false if a detector was flagged.
+  bool update(int run, const CheckpointEntry &target,
+              TH1D *P[kNDetectors][kNBunchTypes], const double PI[kNBunchTypes],
+              bool stale[kNSets][kNDetectors]) {
+    CheckpointEntry current = entry(run);
+    CheckpointEntry e = target;
+    bool ok = true;
+    for (int s = 0; s < kNSets; ++s) {
+      for (int d = 0; d < kNDetectors; ++d) {
+        int sign = target.in(s, d) - current.in(s, d);
+        if (sign == 0) {
+          // unchanged: keeps what was added
+          if (target.in(s, d))
+            for (int b = 0; b < kNBunchTypes; ++b)
+              e.print[d][b] = current.print[d][b];
+          continue;
+        }
+        bool same = true;
+        for (int b = 0; b < kNBunchTypes; ++b)
+          same &= current.print[d][b] == PartialPrint(P[d][b], PI[b]);
+        if (sign < 0 && !same) {
+          stale[s][d] = true;
+          ok = false;
+          continue;
+        }
+        for (int b = 0; b < kNBunchTypes; ++b) {
+          AddPartial(H[s][d][b], P[d][b], sign);
+          if (sign > 0)
+            e.print[d][b] = PartialPrint(P[d][b], PI[b]);
+        }
+      }
+    }
+    if (!target.any())
+      runs.erase(run);
+    else
+      runs[run] = e;
+    return ok;
+  }
+
+  // Sum again the partial results of the runs of set s in detector d. Runs
+  // whose partial result cannot be read are taken out of the detector (they
+  // are added again once sorted) and returned.
+  std::vector<int> rebuild(int s, int d, const std::string &partial_dir) {
+    std::vector<int> dropped;
+    for (int b = 0; b < kNBunchTypes; ++b)
+      H[s][d][b]->Reset();
+    for (auto it = runs.begin(); it != runs.end();) {
+      CheckpointEntry &e = it->second;
+      if (!e.in(s, d)) {
+        ++it;
+        continue;
+      }
+      TH1D *P[kNDetectors][kNBunchTypes];
+      double PI[kNBunchTypes];
+      std::string error;
+      if (ReadPartial(PartialPath(partial_dir, it->first), params, P, PI,
+                      error)) {
+        for (int b = 0; b < kNBunchTypes; ++b) {
+          AddPartial(H[s][d][b], P[d][b], 1);
+          e.print[d][b] = PartialPrint(P[d][b], PI[b]);
+        }
+        for (int dd = 0; dd < kNDetectors; ++dd)
+          for (int b = 0; b < kNBunchTypes; ++b)
+            delete P[dd][b];
+      } else {
+        dropped.push_back(it->first);
+        e.det[d] = false;
+        for (int b = 0; b < kNBunchTypes; ++b)
+          e.print[d][b] = PartialPrint();
+        if (!e.any()) {
+          it = runs.erase(it);
+          continue;
+        }
+      }
+      ++it;
+    }
+    return dropped;
+  }
+
+  // Pulse intensity sums of the runs added, in the order of the run lists of
+  // each set (as Transmission_final.C and Transmission_merge.C)
+  void PulseIntensities(const std::vector<int> order[kNSets],
+                        double PI_S[kNSets][kNDetectors][kNBunchTypes]) const {
+    for (int s = 0; s < kNSets; ++s)
+      for (int d = 0; d < kNDetectors; ++d)
+        for (int b = 0; b < kNBunchTypes; ++b)
+          PI_S[s][d][b] = 0;
+    for (int s = 0; s < kNSets; ++s) {
+      for (int run : order[s]) {
+        CheckpointEntry e = entry(run);
+        for (int d = 0; d < kNDetectors; ++d)
+          if (e.in(s, d))
+            for (int b = 0; b < kNBunchTypes; ++b)
+              PI_S[s][d][b] += e.print[d][b].PI;
+      }
+    }
+  }
+
+private:
+  // run, set, detector mask, fingerprint of each detector and bunch type
+  static const int kRunColumns = 3 + 3 * kNDetectors * kNBunchTypes;
+  // version of the checkpoint file
+  static constexpr double kCheckpointVersion = 2;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef PARTIALSTORE_H
+#define PARTIALSTORE_H
+
+// Per-run partial results of Transmission_final.C.
+// For each run the store keeps, for every detector and bunch type, a tof
+// histogram on a fine logaritmic grid, filled whatever the run selection of the
+// detector, and the pulse intensity of each bunch type (in double). The total
+// transmission for any run selection, and any BinPerDecade dividing the fine
+// grid, is then obtained by summing and rebinning the partials
+// (Transmission_merge.C) without sorting the data again.
+// Each partial also stores the amplitude cuts and calibrations it was sorted
+// with: a partial is only used if they match the current ones.
+
+#include "TArrayD.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TVectorD.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "TransmissionEngine.h"
+
+const int kPartialVersion = 1;
+
+// parameters the partial results depend on
+struct PartialParams {
+  int bins_per_decade = 0; // fine grid
+  float cut[kNDetectors] = {};
+  float cal[kNDetectors] = {};
+
+  TVectorD to_vector() const {
+    TVectorD v(2 + 2 * kNDetectors);
+    v[0] = kPartialVersion;
+    v[1] = bins_per_decade;
+    for (int d = 0; d < kNDetectors; ++d) {
+      v[2 + d] = cut[d];
+      v[2 + kNDetectors + d] = cal[d];
+    }
+    return v;
+  }
+};
+
+inline std::string PartialPath(const std::string &partial_dir, int run) {
+  char name[64];
+  snprintf(name, sizeof(name), "/run%d_partial.root", run);
+  return partial_dir + name;
+}
+
+inline std::string PartialHistoName(int d, int b) {
+  char name[64];
+  snprintf(name, sizeof(name), "fine %d %s", kDetectors[d], kBunchNames[b]);
+  return name;
+}
+
+// Write the partial result of a run. The file is written to a temporary name
+// and renamed, so that an interrupted sort never leaves a partial file.
+inline bool WritePartial(const std::string &path,
+                         TH1D *H[kNDetectors][kNBunchTypes],
+                         const double PI[kNBunchTypes],
+                         const PartialParams &params) {
+  std::string tmp = path + ".part";
+  TFile *f = TFile::Open(tmp.c_str(), "RECREATE");
+  if (!f || f->IsZombie()) {
+    delete f;
+    return false;
+  }
+
+  for (int d = 0; d < kNDetectors; ++d)
+    for (int b = 0; b < kNBunchTypes; ++b)
+      f->WriteTObject(H[d][b], PartialHistoName(d, b).c_str());
+
+  TVectorD v_pi(kNBunchTypes, PI);
+  TVectorD v_params = params.to_vector();
+  f->WriteTObject(&v_pi, "pulse_intensity");
+  f->WriteTObject(&v_params, "params");
+  f->Close();
+  delete f;
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// compare the parameters stored in a partial result with params
+inline bool PartialParamsMatch(const TVectorD *v_params,
+                               const PartialParams &params,
+                               std::string &error) {
+  TVectorD expected = params.to_vector();
+  if (!v_params || v_params->GetNrows() != expected.GetNrows()) {
+    error = "invalid file";
+    return false;
+  }
+  for (int i = 0; i < expected.GetNrows(); ++i) {
+    if ((*v_params)[i] != expected[i]) {
+      error = "sorted with different bins/cuts/calibrations";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Check that the partial result of a run exists and was sorted with params,
+// without reading its histograms
+inline bool CheckPartial(const std::string &path, const PartialParams &params,
+                         std::string &error) {
+  TFile *f = TFile::Open(path.c_str(), "READ");
+  if (!f || f->IsZombie()) {
+    delete f;
+    error = "missing";
+    return false;
+  }
+  TVectorD *v_params = (TVectorD *)f->Get("params");
+  bool ok = PartialParamsMatch(v_params, params, error);
+  delete v_params;
+  delete f;
+  return ok;
+}
+
+// Read the partial result of a run into H (new histograms owned by the caller)
+// and PI. Returns false, with the reason in error, if the partial is missing or
+// was sorted with different parameters.
+inline bool ReadPartial(const std::string &path, const PartialParams &params,
+                        TH1D *H[kNDetectors][kNBunchTypes],
+                        double PI[kNBunchTypes], std::string &error) {
+  TFile *f = TFile::Open(path.c_str(), "READ");
+  if (!f || f->IsZombie()) {
+    delete f;
+    error = "missing";
+    return false;
+  }
+
+  for (int d = 0; d < kNDetectors; ++d)
+    for (int b = 0; b < kNBunchTypes; ++b)
+      H[d][b] = nullptr;
+
+  TVectorD *v_params = (TVectorD *)f->Get("params");
+  TVectorD *v_pi = (TVectorD *)f->Get("pulse_intensity");
+  bool ok = v_pi && PartialParamsMatch(v_params, params, error);
+  if (!v_pi)
+    error = "invalid file";
+
+  for (int d = 0; ok && d < kNDetectors; ++d) {
+    for (int b = 0; b < kNBunchTypes; ++b) {
+      H[d][b] = (TH1D *)f->Get(PartialHistoName(d, b).c_str());
+      if (!H[d][b]) {
+        error = "invalid file";
+        ok = false;
+        break;
+      }
+      H[d][b]->SetDirectory(nullptr);
+    }
+  }
+  if (ok) {
+    for (int b = 0; b < kNBunchTypes; ++b)
+      PI[b] = (*v_pi)[b];
+  } else {
+    for (int d = 0; d < kNDetectors; ++d)
+      for (int b = 0; b < kNBunchTypes; ++b)
+        delete H[d][b];
+  }
+
+  delete v_params;
+  delete v_pi;
+  delete f;
+  return ok;
+}
+
+// Add (sign = 1) or subtract (sign = -1) the histogram h to sum, contents and
+// sums of squared weights alike, so that subtracting a histogram previously
+// added gives back the same sum (TH1::Add with -1 would add the errors).
+inline void AddPartial(TH1D *sum, const TH1D *h, int sign) {
+  double *c = sum->GetArray();
+  double *w2 = sum->GetSumw2()->GetArray();
+  const double *hc = h->GetArray();
+  const double *hw2 = h->GetSumw2()->GetArray();
+  int n = sum->GetNbinsX() + 2;
+  for (int i = 0; i < n; ++i) {
+    c[i] += sign * hc[i];
+    w2[i] += sign * hw2[i];
+  }
+  sum->SetEntries(sum->GetEntries() + sign * h->GetEntries());
+}
+
+// Sum of the bin contents of a partial histogram, underflow and overflow
+// included. The contents are integer counts, so the sum is exact and identifies,
+// with the entries, the partial result a sum was built with.
+inline double PartialCounts(const TH1D *h) {
+  const double *c = h->GetArray();
+  double sum = 0;
+  for (int i = 0; i < h->GetNbinsX() + 2; ++i)
+    sum += c[i];
+  return sum;
+}
+
+// Histogram with the bins of xbins_tof holding the sums of the fine histogram
+// in groups of ngroup bins
+inline TH1D *RebinPartial(TH1D *fine, int ngroup, const char *name,
+                          const std::vector<double> &xbins_tof) {
+  TH1D *HR = (TH1D *)fine->Rebin(ngroup, "rebinned");
+  int n_vec_tof = xbins_tof.size() - 1;
+  TH1D *h = new TH1D(name, "", n_vec_tof, xbins_tof.data());
+  h->Sumw2();
+  for (int i = 0; i <= n_vec_tof + 1; ++i) {
+    h->SetBinContent(i, HR->GetBinContent(i));
+    h->SetBinError(i, HR->GetBinError(i));
+  }
+  h->SetEntries(HR->GetEntries());
+  delete HR;
+  return h;
+}
+
+#endif
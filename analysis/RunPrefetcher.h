@@ -0,0 +1,241 @@
+#ifndef RUNPREFETCHER_H
+#define RUNPREFETCHER_H
+
+// Read-ahead I/O stage for the run files.
+// Background I/O threads open the next `depth` files of the run list while the
+// current ones are being analyzed. If a cache directory is given, each remote
+// file is first copied to a local mirror, which is kept under a maximum size by
+// removing the least recently used files, so that repeated passes read from
+// local disk. Each mirror copy keeps the size and modification time of its
+// source (in <copy>.src): like a skim (see CheckSkim), it is copied again when
+// the source changed, and used as it is when the source cannot be reached.
+// The prefix of the run files can be a local directory as well.
+// Runs with an empty path are not read (e.g. runs with an up-to-date skim).
+
+#include "TFile.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// I/O counters of one run
+struct RunIOStats {
+  double open_seconds = 0;  // copy to the mirror (if any) + TFile::Open
+  double stall_seconds = 0; // time the analysis waited for the file
+  Long64_t bytes_read = 0;  // bytes copied to the mirror + read from the file
+  bool cache_hit = false;   // file found in the local mirror
+};
+
+class RunPrefetcher {
+private:
+  struct Slot {
+    bool ready = false;
+    TFile *file = nullptr;
+    std::string local; // path of the mirror copy, empty if not cached
+    RunIOStats io;
+  };
+
+  std::vector<std::string> urls;
+  std::vector<Slot> slots;
+  size_t depth;
+  std::string cache_dir;
+  uintmax_t cache_max_bytes;
+
+  std::mutex m;
+  std::condition_variable cv;
+  size_t next = 0;     // next file to prefetch
+  size_t acquired = 0; // files requested by the analysis
+  bool stop = false;
+  std::multiset<std::string> in_use; // mirror files currently open
+  std::vector<std::thread> io_threads;
+
+  // name of the mirror copy of a file: its full path with separators replaced
+  std::string mirror_path(const std::string &url) const {
+    std::string name = url;
+    for (char &c : name)
+      if (c == '/' || c == ':')
+        c = '_';
+    return (std::filesystem::path(cache_dir) / name).string();
+  }
+
+  // remove least recently used mirror files until the cache fits its maximum
+  // size. Called with the mutex locked.
+  void evict() {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<fs::file_time_type, fs::path>> files;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (auto &e : fs::directory_iterator(cache_dir, ec)) {
+      if (!e.is_regular_file() || e.path().extension() != ".root")
+        continue;
+      total += e.file_size();
+      files.emplace_back(e.last_write_time(), e.path());
+    }
+    std::sort(files.begin(), files.end());
+    for (auto &f : files) {
+      if (total <= cache_max_bytes)
+        break;
+      if (in_use.count(f.second.string()))
+        continue;
+      uintmax_t size = fs::file_size(f.second, ec);
+      if (fs::remove(f.second, ec)) {
+        total -= size;
+        fs::remove(f.second.string() + ".src", ec);
+      }
+    }
+  }
+
+  // copy the file to the mirror if needed; returns the path to open
+  std::string fetch(const std::string &url, Slot &slot) {
+    namespace fs = std::filesystem;
+    if (cache_dir.empty())
+      return url;
+
+    std::string local = mirror_path(url);
+    std::error_code ec;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      in_use.insert(local);
+      slot.local = local;
+    }
+    // size and modification time of the source, and of the source the mirror
+    // was copied from
+    FileStat_t st;
+    bool reachable = gSystem->GetPathInfo(url.c_str(), st) == 0;
+    Long64_t src_size = -1, src_mtime = -1;
+    std::ifstream(local + ".src") >> src_size >> src_mtime;
+    bool fresh =
+        !reachable || (src_size == st.fSize && src_mtime == st.fMtime);
+
+    if (fs::exists(local, ec) && fresh) {
+      // mark as recently used
+      fs::last_write_time(local, fs::file_time_type::clock::now(), ec);
+      slot.io.cache_hit = true;
+      return local;
+    }
+
+    // copy to a temporary name first, so that an interrupted copy is never
+    // taken as a valid mirror
+    std::string tmp = local + ".part";
+    bool copied = TFile::Cp(url.c_str(), tmp.c_str(), kFALSE);
+    if (copied) {
+      uintmax_t size = fs::file_size(tmp, ec);
+      if (!ec)
+        slot.io.bytes_read += size;
+      fs::rename(tmp, local, ec);
+    }
+    if (!copied || ec) {
+      fs::remove(tmp, ec);
+      return url; // fall back to the original file
+    }
+    if (reachable)
+      std::ofstream(local + ".src") << st.fSize << " " << st.fMtime << "\n";
+    else
+      fs::remove(local + ".src", ec);
+
+    std::lock_guard<std::mutex> lock(m);
+    evict();
+    return local;
+  }
+
+  void io_loop() {
+    for (;;) {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] {
+          return stop || (next < urls.size() && next < acquired + depth);
+        });
+        if (stop)
+          return;
+        i = next++;
+      }
+
+      // an empty path is a run that does not need to be read
+      Slot &slot = slots[i];
+      TFile *f = nullptr;
+      if (!urls[i].empty()) {
+        TStopwatch timer;
+        std::string path = fetch(urls[i], slot);
+        f = TFile::Open(path.c_str(), "READ");
+        if (f && (f->IsZombie() || !f->IsOpen())) {
+          delete f;
+          f = nullptr;
+        }
+        slot.io.open_seconds = timer.RealTime();
+      }
+
+      std::lock_guard<std::mutex> lock(m);
+      slot.file = f;
+      slot.ready = true;
+      cv.notify_all();
+    }
+  }
+
+public:
+  // depth: number of files opened ahead of the analysis
+  // cache_dir: local mirror directory, empty to read the files in place
+  RunPrefetcher(const std::vector<std::string> &urls_, int depth_,
+                const std::string &cache_dir_ = "",
+                double cache_max_gb = 0, int n_io_threads = 2)
+      : urls(urls_), slots(urls_.size()), depth(std::max(1, depth_)),
+        cache_dir(cache_dir_),
+        cache_max_bytes((uintmax_t)(cache_max_gb * 1024. * 1024. * 1024.)) {
+    if (!cache_dir.empty())
+      std::filesystem::create_directories(cache_dir);
+    n_io_threads = std::max(1, std::min<int>(n_io_threads, depth));
+    for (int i = 0; i < n_io_threads; ++i)
+      io_threads.emplace_back(&RunPrefetcher::io_loop, this);
+  }
+
+  ~RunPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &th : io_threads)
+      th.join();
+    for (auto &s : slots)
+      delete s.file;
+  }
+
+  // wait for file i and take its ownership; nullptr if it cannot be opened.
+  // Files are expected to be acquired roughly in the order of the list.
+  TFile *acquire(size_t i, RunIOStats &io) {
+    TStopwatch timer;
+    std::unique_lock<std::mutex> lock(m);
+    acquired++;
+    cv.notify_all();
+    cv.wait(lock, [&] { return slots[i].ready; });
+
+    TFile *f = slots[i].file;
+    slots[i].file = nullptr;
+    io = slots[i].io;
+    io.stall_seconds = timer.RealTime();
+    return f;
+  }
+
+  // close file i after the analysis and allow its mirror copy to be evicted
+  void release(size_t i, TFile *f, RunIOStats &io) {
+    if (f) {
+      io.bytes_read += f->GetBytesRead();
+      delete f;
+    }
+    std::lock_guard<std::mutex> lock(m);
+    if (!slots[i].local.empty()) {
+      auto it = in_use.find(slots[i].local);
+      if (it != in_use.end())
+        in_use.erase(it);
+    }
+  }
+};
+
+#endif
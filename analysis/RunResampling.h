@@ -0,0 +1,339 @@
+#ifndef RUNRESAMPLING_H
+#define RUNRESAMPLING_H
+
+// Run-level resampling of the total transmission (Transmission_resampling.C).
+// Each run holds its tof histograms at the analysis binning, for each channel
+// (detector and bunch type), and its pulse intensity. A replica gives each run
+// a weight and recomputes the total transmission from the weighted sums, as
+// TotalTransmission() does: the average over the channels of
+// (Sin / PI_Sin) / (Sout / PI_Sout), with 0 in the bins where Sout is empty.
+// A channel left without runs in a replica (no pulse intensity in Sin or
+// Sout) is not part of the average of that replica.
+//  - bootstrap: each run list (Sin_DET* or Sout_DET*: the channels of one
+//    detector in one set) is resampled on its own. Its runs are drawn with
+//    replacement as many times as there are runs in the list, and a run drawn
+//    k times has weight k in the channels of that list. Every replica thus
+//    keeps the number of runs of each list, and no channel is left empty: a
+//    detector with few runs does not see its number of runs change from
+//    replica to replica, as it would if whole sets were drawn. A run in
+//    several lists gets independent weights in each. The replica k uses its
+//    own generator, seeded from (seed, k), so the results do not depend on the
+//    number of jobs.
+//  - jackknife: within each run list, each replica leaves one run out of the
+//    channels of the list, its contribution being subtracted from the total
+//    sums. The variance is the sum over the lists of their jackknife
+//    variances, (n_l - 1) / n_l times the sum of the squared deviations of
+//    their n_l replicas from their mean, so that each list is treated as in
+//    the bootstrap.
+// Leaving a run out of all its lists at once (LeaveOneOut) gives the influence
+// of each run (RunInfluence): the RMS over the bins of the shift of the
+// transmission when the run is left out, T without the run - T of all the
+// runs, in units of the statistical error of T of all the runs.
+// This header does not depend on ROOT.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "RunScheduler.h"
+
+// per-run histograms of the resampling
+struct ResamplingData {
+  int nchannels = 0;
+  int nbins = 0;
+  int list_channels = 1; // consecutive channels sharing a run list
+  struct Run {
+    int run = 0;
+    int set = 0;               // 0: sample in, 1: sample out
+    std::vector<char> used;    // channel in the detector lists of the run
+    std::vector<double> counts; // nchannels * nbins
+    std::vector<double> PI;     // pulse intensity of each channel
+  };
+  std::vector<Run> runs;
+
+  // add w times the run to the sums of the channels [c0, c1)
+  void add_channels(const Run &r, double w, int c0, int c1,
+                    std::vector<double> &S, std::vector<double> &PI) const {
+    for (int c = c0; c < c1; ++c) {
+      if (!r.used[c])
+        continue;
+      double *s = &S[(r.set * nchannels + c) * nbins];
+      const double *x = &r.counts[c * nbins];
+      for (int i = 0; i < nbins; ++i)
+        s[i] += w * x[i];
+      PI[r.set * nchannels + c] += w * r.PI[c];
+    }
+  }
+
+  void add_weighted(const Run &r, double w, std::vector<double> &S,
+                    std::vector<double> &PI) const {
+    add_channels(r, w, 0, nchannels, S, PI);
+  }
+
+  // add w times the run to the sums of the channels of the run list l
+  void add_list(const Run &r, int l, double w, std::vector<double> &S,
+                std::vector<double> &PI) const {
+    add_channels(r, w, l * list_channels, (l + 1) * list_channels, S, PI);
+  }
+
+  // weighted sums S (set, channel, bin) and PI (set, channel)
+  void sums(const std::vector<double> &w, std::vector<double> &S,
+            std::vector<double> &PI) const {
+    S.assign(2 * nchannels * nbins, 0.);
+    PI.assign(2 * nchannels, 0.);
+    for (size_t k = 0; k < runs.size(); ++k)
+      if (w[k] != 0)
+        add_weighted(runs[k], w[k], S, PI);
+  }
+
+  int nlists() const { return nchannels / list_channels; }
+
+  // the same with a weight per run and run list, w[k * nlists() + l]
+  void list_sums(const std::vector<double> &w, std::vector<double> &S,
+                 std::vector<double> &PI) const {
+    S.assign(2 * nchannels * nbins, 0.);
+    PI.assign(2 * nchannels, 0.);
+    int n_lists = nlists();
+    for (size_t k = 0; k < runs.size(); ++k)
+      for (int l = 0; l < n_lists; ++l)
+        if (w[k * n_lists + l] != 0)
+          add_list(runs[k], l, w[k * n_lists + l], S, PI);
+  }
+
+  // runs of each set and run list, members[set * nlists() + l], in the order
+  // of runs
+  std::vector<std::vector<size_t>> list_members() const {
+    int n_lists = nlists();
+    std::vector<std::vector<size_t>> members(2 * n_lists);
+    for (size_t k = 0; k < runs.size(); ++k)
+      for (int l = 0; l < n_lists; ++l)
+        if (runs[k].used[l * list_channels])
+          members[runs[k].set * n_lists + l].push_back(k);
+    return members;
+  }
+
+  // total transmission from the sums, averaged over the channels with runs
+  // in both sets
+  void transmission(const std::vector<double> &S, const std::vector<double> &PI,
+                    double *T) const {
+    std::fill(T, T + nbins, 0.);
+    int used = 0;
+    for (int c = 0; c < nchannels; ++c) {
+      double pi_in = PI[c], pi_out = PI[nchannels + c];
+      if (!(pi_in > 0 && pi_out > 0))
+        continue;
+      used++;
+      const double *in = &S[c * nbins];
+      const double *out = &S[(nchannels + c) * nbins];
+      for (int i = 0; i < nbins; ++i)
+        if (out[i] != 0)
+          T[i] += (in[i] / pi_in) / (out[i] / pi_out);
+    }
+    for (int i = 0; used > 0 && i < nbins; ++i)
+      T[i] /= used;
+  }
+};
+
+struct ResamplingResult {
+  std::vector<double> nominal;  // transmission of all the runs
+  std::vector<double> replicas; // n_replicas * nbins
+  std::vector<double> mean, spread;
+  std::vector<double> covariance; // nbins * nbins
+};
+
+// Mean, spread and covariance of the replicas. The replicas are split in
+// groups (group[k] of replica k, in [0, n_groups)): each deviation is taken
+// from the mean of its group, and weighted by the norm of its group. The
+// covariance rows are computed in parallel.
+inline void ReplicaStatistics(ResamplingResult &res, int nbins,
+                              const std::vector<int> &group,
+                              const std::vector<double> &norm, int jobs) {
+  int n = res.replicas.size() / nbins;
+  int n_groups = norm.size();
+  res.mean.assign(nbins, 0.);
+  for (int k = 0; k < n; ++k)
+    for (int i = 0; i < nbins; ++i)
+      res.mean[i] += res.replicas[k * nbins + i];
+  for (int i = 0; i < nbins; ++i)
+    res.mean[i] /= std::max(n, 1);
+
+  std::vector<double> group_mean((size_t)n_groups * nbins, 0.);
+  std::vector<int> group_size(n_groups, 0);
+  for (int k = 0; k < n; ++k) {
+    group_size[group[k]]++;
+    for (int i = 0; i < nbins; ++i)
+      group_mean[group[k] * nbins + i] += res.replicas[k * nbins + i];
+  }
+  for (int g = 0; g < n_groups; ++g)
+    for (int i = 0; i < nbins; ++i)
+      group_mean[g * nbins + i] /= std::max(group_size[g], 1);
+
+  // deviations, scaled by the square root of the norm of their group
+  std::vector<double> dev(res.replicas.size());
+  for (int k = 0; k < n; ++k) {
+    double scale = std::sqrt(norm[group[k]]);
+    for (int i = 0; i < nbins; ++i)
+      dev[k * nbins + i] =
+          scale * (res.replicas[k * nbins + i] - group_mean[group[k] * nbins + i]);
+  }
+
+  res.covariance.assign((size_t)nbins * nbins, 0.);
+  RunPool(nbins, NumberOfJobs(jobs, nbins), [&](size_t i, int) {
+    double *row = &res.covariance[i * nbins];
+    for (int k = 0; k < n; ++k) {
+      double di = dev[k * nbins + i];
+      if (di == 0)
+        continue;
+      const double *dk = &dev[k * nbins];
+      for (size_t j = i; j < (size_t)nbins; ++j)
+        row[j] += di * dk[j];
+    }
+  });
+  for (int i = 0; i < nbins; ++i)
+    for (int j = 0; j < i; ++j)
+      res.covariance[(size_t)i * nbins + j] =
+          res.covariance[(size_t)j * nbins + i];
+
+  res.spread.resize(nbins);
+  for (int i = 0; i < nbins; ++i)
+    res.spread[i] = std::sqrt(res.covariance[(size_t)i * nbins + i]);
+}
+
+// transmission with all the runs
+inline std::vector<double> NominalTransmission(const ResamplingData &data) {
+  std::vector<double> S, PI, T(data.nbins);
+  data.sums(std::vector<double>(data.runs.size(), 1.), S, PI);
+  data.transmission(S, PI, T.data());
+  return T;
+}
+
+// n_replicas bootstrap replicas, computed in parallel
+inline ResamplingResult Bootstrap(const ResamplingData &data, int n_replicas,
+                                  uint64_t seed, int jobs) {
+  ResamplingResult res;
+  int nbins = data.nbins;
+  res.nominal = NominalTransmission(data);
+  res.replicas.assign((size_t)n_replicas * nbins, 0.);
+
+  int n_lists = data.nlists();
+  std::vector<std::vector<size_t>> members = data.list_members();
+
+  int n_jobs = NumberOfJobs(jobs, n_replicas);
+  std::vector<std::vector<double>> S(n_jobs), PI(n_jobs), w(n_jobs);
+  RunPool(n_replicas, n_jobs, [&](size_t r, int worker) {
+    std::mt19937_64 rng(TaskSeed(seed, r));
+    std::vector<double> &weights = w[worker];
+    weights.assign(data.runs.size() * n_lists, 0.);
+    for (int m = 0; m < 2 * n_lists; ++m) {
+      if (members[m].empty())
+        continue;
+      int l = m % n_lists;
+      std::uniform_int_distribution<size_t> pick(0, members[m].size() - 1);
+      for (size_t k = 0; k < members[m].size(); ++k)
+        weights[members[m][pick(rng)] * n_lists + l] += 1;
+    }
+    data.list_sums(weights, S[worker], PI[worker]);
+    data.transmission(S[worker], PI[worker], &res.replicas[r * nbins]);
+  });
+
+  // a single group: 1 / (n - 1) times the sum of the squared deviations
+  ReplicaStatistics(res, nbins, std::vector<int>(n_replicas, 0),
+                    {n_replicas > 1 ? 1. / (n_replicas - 1) : 0.}, jobs);
+  return res;
+}
+
+// one replica per run (in the order of data.runs) leaving the run out of all
+// its lists, computed in parallel from the total sums; only the nominal
+// transmission and the replicas are filled
+inline ResamplingResult LeaveOneOut(const ResamplingData &data, int jobs) {
+  ResamplingResult res;
+  int nbins = data.nbins;
+  size_t n = data.runs.size();
+  res.nominal = NominalTransmission(data);
+  res.replicas.assign(n * nbins, 0.);
+
+  std::vector<double> S_all, PI_all;
+  data.sums(std::vector<double>(n, 1.), S_all, PI_all);
+
+  int n_jobs = NumberOfJobs(jobs, n);
+  std::vector<std::vector<double>> S(n_jobs), PI(n_jobs);
+  RunPool(n, n_jobs, [&](size_t r, int worker) {
+    S[worker] = S_all;
+    PI[worker] = PI_all;
+    data.add_weighted(data.runs[r], -1., S[worker], PI[worker]);
+    data.transmission(S[worker], PI[worker], &res.replicas[r * nbins]);
+  });
+  return res;
+}
+
+// Jackknife within each run list: one replica per list and run of the list
+// (lists in the order of list_members()), leaving the run out of the channels
+// of the list, computed in parallel from the total sums; the jackknife
+// variances of the lists are summed
+inline ResamplingResult Jackknife(const ResamplingData &data, int jobs) {
+  ResamplingResult res;
+  int nbins = data.nbins;
+  res.nominal = NominalTransmission(data);
+
+  int n_lists = data.nlists();
+  std::vector<std::vector<size_t>> members = data.list_members();
+  std::vector<int> group, list;
+  std::vector<size_t> run;
+  std::vector<double> norm(members.size(), 0.);
+  for (size_t m = 0; m < members.size(); ++m) {
+    size_t n_m = members[m].size();
+    for (size_t k : members[m]) {
+      group.push_back(m);
+      list.push_back(m % n_lists);
+      run.push_back(k);
+    }
+    if (n_m > 1)
+      norm[m] = (n_m - 1.) / n_m;
+  }
+  size_t n = run.size();
+  res.replicas.assign(n * nbins, 0.);
+
+  std::vector<double> S_all, PI_all;
+  data.sums(std::vector<double>(data.runs.size(), 1.), S_all, PI_all);
+
+  int n_jobs = NumberOfJobs(jobs, n);
+  std::vector<std::vector<double>> S(n_jobs), PI(n_jobs);
+  RunPool(n, n_jobs, [&](size_t r, int worker) {
+    S[worker] = S_all;
+    PI[worker] = PI_all;
+    data.add_list(data.runs[run[r]], list[r], -1., S[worker], PI[worker]);
+    data.transmission(S[worker], PI[worker], &res.replicas[r * nbins]);
+  });
+
+  ReplicaStatistics(res, nbins, group, norm, jobs);
+  return res;
+}
+
+// Influence of each run from the LeaveOneOut replicas: RMS over the bins of
+// (T without the run - T of all the runs) / error, error being the statistical
+// error of T of all the runs in each bin (bins with no error are skipped).
+// An influence of 1 means that leaving the run out moves the transmission by
+// one statistical error on average.
+inline std::vector<double> RunInfluence(const ResamplingResult &loo,
+                                        const std::vector<double> &error) {
+  int nbins = loo.nominal.size();
+  int n = nbins > 0 ? loo.replicas.size() / nbins : 0;
+  std::vector<double> influence(n, 0.);
+  for (int k = 0; k < n; ++k) {
+    double sum = 0;
+    int used = 0;
+    for (int i = 0; i < nbins; ++i) {
+      if (!(error[i] > 0))
+        continue;
+      double z = (loo.replicas[k * nbins + i] - loo.nominal[i]) / error[i];
+      sum += z * z;
+      used++;
+    }
+    influence[k] = used > 0 ? std::sqrt(sum / used) : 0.;
+  }
+  return influence;
+}
+
+#endif
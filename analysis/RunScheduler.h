@@ -0,0 +1,54 @@
+#ifndef RUNSCHEDULER_H
+#define RUNSCHEDULER_H
+
+// Thread pool used to sort independent runs concurrently.
+// All the tasks are put in a single queue: each worker takes the next task as
+// soon as it is free, so a long list (e.g. Sout) is not serialized after a
+// shorter one. Each worker gets its own index, used to fill a private copy of
+// the output, which is merged in worker order at the end.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// number of workers for a requested number of jobs (<= 0: one per core)
+inline int NumberOfJobs(int jobs, size_t ntasks) {
+  if (jobs <= 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  return std::max(1, std::min<int>(jobs, (int)ntasks));
+}
+
+// call fn(task, worker) for every task in [0, ntasks) using `jobs` workers
+template <class F> void RunPool(size_t ntasks, int jobs, F fn) {
+  std::atomic<size_t> next(0);
+
+  auto worker = [&](int w) {
+    for (size_t t = next++; t < ntasks; t = next++)
+      fn(t, w);
+  };
+
+  if (jobs <= 1) {
+    worker(0);
+    return;
+  }
+
+  std::vector<std::thread> pool;
+  for (int w = 0; w < jobs; ++w)
+    pool.emplace_back(worker, w);
+  for (auto &th : pool)
+    th.join();
+}
+
+// Seed of the random generator of a task (splitmix64 of the global seed and
+// the task number): each task has its own stream, whatever the worker that
+// runs it, so the results do not depend on the number of jobs.
+inline uint64_t TaskSeed(uint64_t seed, uint64_t task) {
+  uint64_t x = seed * 0x9E3779B97F4A7C15ULL + task;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+#endif
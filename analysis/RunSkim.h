@@ -0,0 +1,196 @@
+#ifndef RUNSKIM_H
+#define RUNSKIM_H
+
+// Build the skim of a run (see SkimFormat.h) from its n_TOF ROOT file.
+// Skims are named after the run number and keep the size and modification time
+// of the source file, so that stale skims are detected and rebuilt.
+// These functions can also be called from Python through PyROOT (RunSkim.py).
+// SortRun sorts a run from its skim or from its ROOT file (Transmission_final.C
+// and Transmission_online.C).
+
+#include "TFile.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+#include "SkimFormat.h"
+#include "TransmissionEngine.h"
+
+// state of the skim of a run
+struct SkimStatus {
+  bool fresh = false;      // skim exists and matches the source file
+  Long64_t source_size = -1;
+  Long64_t source_mtime = -1;
+};
+
+// Check the skim of a run against its source file (local or remote). If the
+// source cannot be reached, an existing skim is used as it is.
+inline SkimStatus CheckSkim(const std::string &skim_path,
+                            const std::string &source) {
+  SkimStatus status;
+  FileStat_t st;
+  bool reachable = gSystem->GetPathInfo(source.c_str(), st) == 0;
+  if (reachable) {
+    status.source_size = st.fSize;
+    status.source_mtime = st.fMtime;
+  }
+
+  SkimFile skim;
+  if (skim.open(skim_path))
+    status.fresh =
+        !reachable || skim.matches(status.source_size, status.source_mtime);
+  return status;
+}
+
+// Write the skim of a run from its opened file. The skim is written to a
+// temporary name and renamed, so that readers never see a partial file.
+inline bool BuildSkim(TFile *f, int run, const SkimStatus &status,
+                      const std::string &skim_path) {
+  TTree *t_pkup = (TTree *)f->Get("PKUP");
+  TTree *t_fcu = (TTree *)f->Get("FC-U");
+  if (!t_pkup || !t_fcu)
+    return false;
+
+  // no detector selected: only the bunch table and the PKUP entries are needed
+  DetectorTable none;
+  PkupTable pk;
+  PkupColumns entries;
+  ReadPkupTable(t_pkup, none, pk, &entries);
+
+  FcuBatchReader batch(t_fcu);
+  SkimHeader h =
+      MakeSkimHeader(run, status.source_size, status.source_mtime,
+                     batch.entries(), entries.BunchNumber.size());
+
+  std::string tmp = skim_path + ".part";
+  SkimFile skim;
+  if (!skim.create(tmp, h))
+    return false;
+
+  for (uint64_t iP = 0; iP < h.n_pkup; ++iP) {
+    skim.pk_bunch()[iP] = entries.BunchNumber[iP];
+    skim.pk_PSpulse()[iP] = entries.PSpulse[iP];
+    skim.pk_intensity()[iP] = entries.PulseIntensity[iP];
+    skim.pk_tflash()[iP] = entries.tflash[iP];
+  }
+
+  uint8_t *detn = skim.detn();
+  int8_t *PSpulse = skim.PSpulse();
+  float *amp = skim.amp();
+  double *dt = skim.dt();
+
+  uint64_t i = 0;
+  while (Long64_t n = batch.next()) {
+    JoinBatch(pk, n, batch.tof.data(), batch.BunchNumber.data(), dt + i);
+    for (Long64_t j = 0; j < n; ++j, ++i) {
+      detn[i] = SkimDetn(batch.detn[j]);
+      PSpulse[i] = SkimPSpulse(batch.PSpulse[j]);
+      amp[i] = batch.amp[j];
+    }
+  }
+  if (!skim.close()) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+
+  return std::rename(tmp.c_str(), skim_path.c_str()) == 0;
+}
+
+// Open a run file and build its skim if missing or stale. Returns false if the
+// skim cannot be built.
+inline bool UpdateSkim(const std::string &source, int run,
+                       const std::string &skim_path) {
+  SkimStatus status = CheckSkim(skim_path, source);
+  if (status.fresh)
+    return true;
+
+  TFile *f = TFile::Open(source.c_str(), "READ");
+  if (!f || f->IsZombie() || !f->IsOpen()) {
+    delete f;
+    return false;
+  }
+  bool ok = BuildSkim(f, run, status, skim_path);
+  delete f;
+  return ok;
+}
+
+// Sort one run into the histograms and pulse intensity sums pointed by the
+// detector table. The table is updated with the detectors whose run list
+// contains the run. If skim_path is given, the run is sorted from its skim,
+// which is built first from the run file if missing or stale. Returns false if
+// the run could not be read.
+inline bool SortRun(int Run, const std::string &path, TFile *f_i,
+                    const std::string &skim_path, const SkimStatus &skim_status,
+                    const std::unordered_set<int> det_sets[kNDetectors],
+                    DetectorTable table, bool legacy, RunStats &stats,
+                    StageTimes *stages, std::string &log) {
+
+  std::ostringstream out;
+  out << "Now Sorting " << path << std::endl;
+
+  // check to see if the current run is included in the set of runs of the
+  // various detectors
+  for (int d = 0; d < kNDetectors; ++d) {
+    bool check = det_sets[d].count(Run) > 0;
+    table.slot[kDetectors[d]].selected = check;
+    out << "DET " << kDetectors[d] << ":  " << check << std::endl;
+  }
+
+  if (!skim_path.empty()) {
+    if (!skim_status.fresh) {
+      if (!f_i) {
+        out << "ERROR: cannot open file: " << path << "\n";
+        log = out.str();
+        return false; // skip this run
+      }
+      if (!BuildSkim(f_i, Run, skim_status, skim_path)) {
+        out << "ERROR: cannot write skim: " << skim_path << "\n";
+        log = out.str();
+        return false;
+      }
+      out << "Skim written: " << skim_path << std::endl;
+    }
+
+    SkimFile skim;
+    if (!skim.open(skim_path)) {
+      out << "ERROR: cannot read skim: " << skim_path << "\n";
+      log = out.str();
+      return false;
+    }
+    out << "Reading skim " << skim_path << std::endl;
+    stats = SortRunSkim(skim, table, stages);
+
+    out << "Number of Entries: " << stats.entries << std::endl;
+    out << "Processed entries: " << stats.matched << '\n';
+    log = out.str();
+    return true;
+  }
+
+  if (!f_i) {
+    out << "ERROR: cannot open file: " << path << "\n";
+    log = out.str();
+    return false; // skip this run
+  }
+
+  TTree *t_pkup = (TTree *)f_i->Get("PKUP");
+  TTree *t_fcu = (TTree *)f_i->Get("FC-U");
+  if (!t_pkup || !t_fcu) {
+    out << "WARNING: no PKUP or FC-U tree in " << path << ", run skipped\n";
+    log = out.str();
+    return false;
+  }
+
+  stats = legacy ? SortRunFriendIndex(t_pkup, t_fcu, table, stages)
+                 : SortRunColumnar(t_pkup, t_fcu, table, stages);
+
+  out << "Number of Entries: " << stats.entries << std::endl;
+  out << "Processed entries: " << stats.matched << '\n';
+  log = out.str();
+
+  return true;
+}
+
+#endif
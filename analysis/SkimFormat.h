@@ -0,0 +1,215 @@
+#ifndef SKIMFORMAT_H
+#define SKIMFORMAT_H
+
+// Compact columnar "skim" of one run, holding only what the transmission and
+// amplitude analyses use.
+//   hits (one per FC-U entry):  detn (uint8), PSpulse (int8), amp (float),
+//                               dt = tof - tflash (double, NaN if the bunch is
+//                               not found in PKUP)
+//   pkup (one per PKUP entry):  BunchNumber (int32), PSpulse (int32),
+//                               PulseIntensity (float), tflash (double)
+// The bunch join is done when the skim is written: dt already holds the tflash
+// of the first PKUP entry of the bunch of each hit (as PkupTable matches them),
+// so no per-bunch table is stored. The PKUP entries are kept as they are, not
+// deduplicated per bunch, because the pulse intensity sums run over every
+// entry, as in the sorting of the run files.
+// The file is a fixed header followed by the columns, each one aligned to 64
+// bytes, so it can be memory-mapped and read without copies (see RunSkim.py for
+// the numpy reader). The header keeps the size and modification time of the
+// source file: a skim is stale if they do not match.
+// This header does not depend on ROOT.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char kSkimMagic[8] = {'N', 'T', 'O', 'F', 'S', 'K', 'I', 'M'};
+const uint32_t kSkimVersion = 1;
+
+enum SkimColumn {
+  kSkimDetn,        // uint8, 255 if detn is out of range
+  kSkimPSpulse,     // int8, 0 if PSpulse is out of range
+  kSkimAmp,         // float
+  kSkimDt,          // double
+  kSkimPkBunch,     // int32
+  kSkimPkPSpulse,   // int32
+  kSkimPkIntensity, // float
+  kSkimPkTflash,    // double
+  kSkimNColumns
+};
+
+// size of one element of each column
+const size_t kSkimColumnSize[kSkimNColumns] = {1, 1, 4, 8, 4, 4, 4, 8};
+
+struct SkimHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t run;
+  int64_t source_size;
+  int64_t source_mtime;
+  uint64_t n_hits;
+  uint64_t n_pkup;
+  uint64_t offset[kSkimNColumns]; // byte offset of each column in the file
+};
+static_assert(sizeof(SkimHeader) == 112, "skim header layout changed");
+
+// header of a skim with the given number of hits and PKUP entries
+inline SkimHeader MakeSkimHeader(int run, int64_t source_size,
+                                 int64_t source_mtime, uint64_t n_hits,
+                                 uint64_t n_pkup) {
+  SkimHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kSkimMagic, sizeof(kSkimMagic));
+  h.version = kSkimVersion;
+  h.run = run;
+  h.source_size = source_size;
+  h.source_mtime = source_mtime;
+  h.n_hits = n_hits;
+  h.n_pkup = n_pkup;
+
+  uint64_t pos = sizeof(SkimHeader);
+  for (int c = 0; c < kSkimNColumns; ++c) {
+    pos = (pos + 63) / 64 * 64;
+    h.offset[c] = pos;
+    pos += kSkimColumnSize[c] * (c < kSkimPkBunch ? n_hits : n_pkup);
+  }
+  return h;
+}
+
+// total size of a skim file
+inline uint64_t SkimFileSize(const SkimHeader &h) {
+  int last = kSkimNColumns - 1;
+  return h.offset[last] + kSkimColumnSize[last] * h.n_pkup;
+}
+
+// name of the skim of a run
+inline std::string SkimPath(const std::string &skim_dir, int run) {
+  char name[64];
+  snprintf(name, sizeof(name), "/run%d.skim", run);
+  return skim_dir + name;
+}
+
+// Memory-mapped skim file. The column accessors point into the mapping and
+// stay valid as long as the object lives.
+class SkimFile {
+private:
+  void *map = MAP_FAILED;
+  size_t map_size = 0;
+  bool writable = false;
+
+  template <class T> T *column(SkimColumn c) const {
+    return (T *)((char *)map + header().offset[c]);
+  }
+
+public:
+  SkimFile() {}
+  SkimFile(const SkimFile &) = delete;
+  SkimFile &operator=(const SkimFile &) = delete;
+  ~SkimFile() { close(); }
+
+  // map an existing skim for reading; returns false if missing or invalid
+  bool open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SkimHeader)) {
+      map_size = st.st_size;
+      map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED)
+      return false;
+
+    // every column must be where the layout of the header puts it, inside
+    // the mapping (each element takes at least one byte)
+    const SkimHeader &h = header();
+    bool valid = memcmp(h.magic, kSkimMagic, sizeof(kSkimMagic)) == 0 &&
+                 h.version == kSkimVersion && h.n_hits <= map_size &&
+                 h.n_pkup <= map_size;
+    if (valid) {
+      SkimHeader expected = MakeSkimHeader(h.run, h.source_size,
+                                           h.source_mtime, h.n_hits, h.n_pkup);
+      valid = memcmp(h.offset, expected.offset, sizeof(h.offset)) == 0 &&
+              SkimFileSize(expected) <= map_size;
+    }
+    if (!valid) {
+      close();
+      return false;
+    }
+    madvise(map, map_size, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  // Create a skim of the given layout, mapped for writing. The disk space is
+  // reserved first: writing through the mapping into space the file system
+  // cannot provide (full disk, quota) would raise SIGBUS instead of an error.
+  bool create(const std::string &path, const SkimHeader &h) {
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    map_size = SkimFileSize(h);
+    if (posix_fallocate(fd, 0, map_size) == 0)
+      map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      map_size = 0;
+      unlink(path.c_str());
+      return false;
+    }
+    writable = true;
+    memcpy(map, &h, sizeof(h));
+    return true;
+  }
+
+  // unmap the skim; returns false if the data written could not be flushed
+  bool close() {
+    bool ok = true;
+    if (map != MAP_FAILED) {
+      if (writable)
+        ok = msync(map, map_size, MS_SYNC) == 0;
+      ok = munmap(map, map_size) == 0 && ok;
+    }
+    map = MAP_FAILED;
+    map_size = 0;
+    writable = false;
+    return ok;
+  }
+
+  bool is_open() const { return map != MAP_FAILED; }
+  const SkimHeader &header() const { return *(const SkimHeader *)map; }
+
+  // a skim is up to date if it was built from a source with the same size and
+  // modification time
+  bool matches(int64_t source_size, int64_t source_mtime) const {
+    return is_open() && header().source_size == source_size &&
+           header().source_mtime == source_mtime;
+  }
+
+  uint8_t *detn() const { return column<uint8_t>(kSkimDetn); }
+  int8_t *PSpulse() const { return column<int8_t>(kSkimPSpulse); }
+  float *amp() const { return column<float>(kSkimAmp); }
+  double *dt() const { return column<double>(kSkimDt); }
+  int32_t *pk_bunch() const { return column<int32_t>(kSkimPkBunch); }
+  int32_t *pk_PSpulse() const { return column<int32_t>(kSkimPkPSpulse); }
+  float *pk_intensity() const { return column<float>(kSkimPkIntensity); }
+  double *pk_tflash() const { return column<double>(kSkimPkTflash); }
+};
+
+// values stored in the narrow hit columns
+inline uint8_t SkimDetn(int detn) {
+  return (detn >= 0 && detn < 255) ? (uint8_t)detn : 255;
+}
+inline int8_t SkimPSpulse(int PSpulse) {
+  return (PSpulse >= -128 && PSpulse <= 127) ? (int8_t)PSpulse : 0;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef STAGETIMERS_H
+#define STAGETIMERS_H
+
+// Optional timing of the stages of the analysis (stage_timers = 1 in the cmnd
+// file). Timers are given a null StageTimes when disabled, and then do not
+// read the clock at all.
+
+#include <chrono>
+#include <ostream>
+
+enum Stage {
+  kStageOpen,  // opening the run files
+  kStagePkup,  // reading PKUP: pulse intensities and bunch table
+  kStageJoin,  // matching the FC-U hits to their PKUP bunch
+  kStageLoop,  // reading the FC-U columns and filling the histograms
+  kStageMerge, // merging the histograms of the workers
+  kStageWrite, // writing the outputs
+  kNStages
+};
+const char *const kStageNames[kNStages] = {
+    "file open",  "PKUP scan",       "index/join",
+    "event loop", "histogram merge", "output write"};
+
+struct StageTimes {
+  double seconds[kNStages] = {};
+
+  StageTimes &operator+=(const StageTimes &o) {
+    for (int s = 0; s < kNStages; ++s)
+      seconds[s] += o.seconds[s];
+    return *this;
+  }
+
+  void print(std::ostream &out) const {
+    for (int s = 0; s < kNStages; ++s)
+      out << "Stage " << kStageNames[s] << ": " << seconds[s] << " s\n";
+  }
+};
+
+// adds the time from its creation to stop() (or its destruction) to a stage
+class StageTimer {
+private:
+  using Clock = std::chrono::steady_clock;
+  StageTimes *times;
+  Stage stage;
+  Clock::time_point start;
+
+public:
+  StageTimer(StageTimes *times, Stage stage) : times(times), stage(stage) {
+    if (times)
+      start = Clock::now();
+  }
+  ~StageTimer() { stop(); }
+
+  void stop() {
+    if (!times)
+      return;
+    times->seconds[stage] +=
+        std::chrono::duration<double>(Clock::now() - start).count();
+    times = nullptr;
+  }
+};
+
+#endif
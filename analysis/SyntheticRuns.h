@@ -0,0 +1,177 @@
+#ifndef SYNTHETICRUNS_H
+#define SYNTHETICRUNS_H
+
+// Synthetic n_TOF runs, to test and benchmark the analyses without access to
+// the real data (see Synthetic_runs.C). Each run file holds a PKUP and a FC-U
+// tree with the branches read by the analyses:
+//   PKUP: tflash/D, PulseIntensity/F, BunchNumber/I, PSpulse/I
+//   FC-U: detn/I, tof/D, amp/F, BunchNumber/I, PSpulse/I, PulseIntensity/F
+// Bunches are dedicated (PSpulse 2) or parasitic (PSpulse 3), with about half
+// the intensity. The hits of a bunch are proportional to its intensity and
+// sorted by tof; tof - tflash is log-uniform from 1 us to 100 ms, plus a gamma
+// flash below 1 us. Amplitudes are a Landau signal over an exponential noise.
+// A fraction of the bunches is left out of PKUP, so that their hits are not
+// matched. For the sample-in runs only a fraction `transmission` of the
+// neutron hits is kept. The same seed and run number always give the same
+// file.
+
+#include "TFile.h"
+#include "TRandom3.h"
+#include "TTree.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "RunScheduler.h"
+
+struct SyntheticConfig {
+  Long64_t hits_per_run = 1000000;
+  int bunches_per_run = 1000;
+  double dedicated_fraction = 0.5;
+  std::vector<int> detectors = {1, 2, 3, 4, 7, 8};
+  std::vector<int> detector_weights; // relative hits per detector, empty: same
+  double unmatched_fraction = 0.01;  // bunches missing from PKUP
+  double gamma_fraction = 0.05;      // hits of the gamma flash
+  double noise_fraction = 0.2;       // hits with a noise amplitude
+  double transmission = 1.0;         // fraction of the neutron hits kept
+  unsigned seed = 1;
+};
+
+// seed of the random generator of a run (never 0: TRandom3 would then use the
+// clock)
+inline unsigned SyntheticSeed(unsigned seed, int run) {
+  return (unsigned)TaskSeed(seed, (unsigned)run) | 1u;
+}
+
+// one FC-U hit before it is written
+struct SyntheticHit {
+  double tof;
+  int detn;
+  float amp;
+};
+
+// Write the synthetic run `run` to path (a temporary file renamed at the end).
+// Returns false if the file cannot be written.
+inline bool WriteSyntheticRun(const std::string &path, int run,
+                              const SyntheticConfig &cfg) {
+  TRandom3 rng(SyntheticSeed(cfg.seed, run));
+  int nb = std::max(1, cfg.bunches_per_run);
+  int nd = cfg.detectors.size();
+  if (nd == 0)
+    return false;
+
+  // cumulative detector weights
+  std::vector<double> cumw(nd);
+  double sumw = 0;
+  for (int d = 0; d < nd; ++d) {
+    sumw += d < (int)cfg.detector_weights.size()
+                ? std::max(0, cfg.detector_weights[d])
+                : 1;
+    cumw[d] = sumw;
+  }
+  if (!(sumw > 0))
+    return false;
+
+  // bunches
+  std::vector<int> PSpulse(nb);
+  std::vector<float> intensity(nb);
+  std::vector<double> tflash(nb);
+  std::vector<char> in_pkup(nb);
+  double sum_pi = 0;
+  for (int b = 0; b < nb; ++b) {
+    bool dedicated = rng.Uniform() < cfg.dedicated_fraction;
+    PSpulse[b] = dedicated ? 2 : 3;
+    double pi = dedicated ? rng.Gaus(7.0e12, 0.5e12) : rng.Gaus(3.5e12, 0.3e12);
+    intensity[b] = std::max(pi, 1e11);
+    tflash[b] = rng.Gaus(600., 5.);
+    in_pkup[b] = rng.Uniform() >= cfg.unmatched_fraction;
+    sum_pi += intensity[b];
+  }
+
+  std::string tmp = path + ".part";
+  TFile *f = TFile::Open(tmp.c_str(), "RECREATE");
+  if (!f || f->IsZombie()) {
+    delete f;
+    return false;
+  }
+
+  double v_tflash, v_tof;
+  float v_pi, v_amp;
+  int v_bunch, v_pspulse, v_detn;
+
+  TTree *t_pkup = new TTree("PKUP", "PKUP");
+  t_pkup->SetDirectory(f);
+  t_pkup->Branch("tflash", &v_tflash, "tflash/D");
+  t_pkup->Branch("PulseIntensity", &v_pi, "PulseIntensity/F");
+  t_pkup->Branch("BunchNumber", &v_bunch, "BunchNumber/I");
+  t_pkup->Branch("PSpulse", &v_pspulse, "PSpulse/I");
+
+  TTree *t_fcu = new TTree("FC-U", "FC-U");
+  t_fcu->SetDirectory(f);
+  t_fcu->Branch("detn", &v_detn, "detn/I");
+  t_fcu->Branch("tof", &v_tof, "tof/D");
+  t_fcu->Branch("amp", &v_amp, "amp/F");
+  t_fcu->Branch("BunchNumber", &v_bunch, "BunchNumber/I");
+  t_fcu->Branch("PSpulse", &v_pspulse, "PSpulse/I");
+  t_fcu->Branch("PulseIntensity", &v_pi, "PulseIntensity/F");
+
+  // hits of each bunch proportional to its intensity, hits_per_run in total
+  std::vector<SyntheticHit> hits;
+  double cum_pi = 0;
+  Long64_t written = 0;
+  for (int b = 0; b < nb; ++b) {
+    cum_pi += intensity[b];
+    Long64_t until = (Long64_t)std::floor(cfg.hits_per_run * cum_pi / sum_pi);
+    if (b == nb - 1)
+      until = cfg.hits_per_run;
+    Long64_t n = until - written;
+    written = until;
+
+    hits.clear();
+    for (Long64_t i = 0; i < n; ++i) {
+      int d = std::upper_bound(cumw.begin(), cumw.end(), rng.Uniform(sumw)) -
+              cumw.begin();
+      SyntheticHit h;
+      h.detn = cfg.detectors[std::min(d, nd - 1)];
+      if (rng.Uniform() < cfg.gamma_fraction) {
+        h.tof = tflash[b] + rng.Gaus(650., 10.);
+      } else {
+        if (rng.Uniform() >= cfg.transmission)
+          continue;
+        h.tof = tflash[b] + std::pow(10., rng.Uniform(3., 8.));
+      }
+      h.amp = rng.Uniform() < cfg.noise_fraction ? rng.Exp(2.0e3)
+                                                 : rng.Landau(12.0e3, 1.5e3);
+      hits.push_back(h);
+    }
+    std::sort(hits.begin(), hits.end(),
+              [](const SyntheticHit &a, const SyntheticHit &c) {
+                return a.tof < c.tof;
+              });
+
+    v_tflash = tflash[b];
+    v_pi = intensity[b];
+    v_bunch = b + 1;
+    v_pspulse = PSpulse[b];
+    if (in_pkup[b])
+      t_pkup->Fill();
+    for (const SyntheticHit &h : hits) {
+      v_detn = h.detn;
+      v_tof = h.tof;
+      v_amp = h.amp;
+      t_fcu->Fill();
+    }
+  }
+
+  f->cd();
+  t_pkup->Write();
+  t_fcu->Write();
+  f->Close();
+  delete f;
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TRANSMISSIONENERGY_H
+#define TRANSMISSIONENERGY_H
+
+// ROOT side of CrossSection.h: transmission histogram in, energy domain
+// histograms (transmission and cross section) out.
+
+#include "TH1D.h"
+#include <vector>
+
+#include "CrossSection.h"
+
+inline TransmissionSpectrum SpectrumOf(const TH1D *h) {
+  TransmissionSpectrum spectrum;
+  int nbins = h->GetNbinsX();
+  for (int i = 1; i <= nbins + 1; ++i)
+    spectrum.tof_edges.push_back(h->GetXaxis()->GetBinLowEdge(i));
+  for (int i = 1; i <= nbins; ++i) {
+    spectrum.T.push_back(h->GetBinContent(i));
+    spectrum.T_error.push_back(h->GetBinError(i));
+  }
+  return spectrum;
+}
+
+// histogram on the energy bins of res, with the given contents and errors
+inline TH1D *EnergyHisto(const CrossSectionResult &res, const char *name,
+                         const std::vector<double> &content,
+                         const std::vector<double> &error) {
+  TH1D *h = new TH1D(name, "", res.sigma.size(), res.E_edges.data());
+  h->Sumw2();
+  for (size_t j = 0; j < res.sigma.size(); ++j) {
+    h->SetBinContent(j + 1, content[j]);
+    h->SetBinError(j + 1, error[j]);
+  }
+  h->GetXaxis()->SetTitle("Neutron energy (eV)");
+  return h;
+}
+
+// transmission as a function of the neutron energy
+inline TH1D *TransmissionVsEnergy(const TransmissionSpectrum &spectrum,
+                                  const CrossSectionResult &res,
+                                  const char *name) {
+  std::vector<double> T, T_error;
+  for (int i : res.tof_bin) {
+    T.push_back(spectrum.T[i]);
+    T_error.push_back(spectrum.T_error[i]);
+  }
+  return EnergyHisto(res, name, T, T_error);
+}
+
+inline TH1D *CrossSectionHisto(const CrossSectionResult &res,
+                               const char *name) {
+  TH1D *h = EnergyHisto(res, name, res.sigma, res.error);
+  h->GetYaxis()->SetTitle("Cross section (barn)");
+  return h;
+}
+
+#endif
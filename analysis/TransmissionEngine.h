@@ -0,0 +1,506 @@
+#ifndef TRANSMISSIONENGINE_H
+#define TRANSMISSIONENGINE_H
+
+// Event-loop engine for Transmission_final.C.
+// The PKUP tree is read once into a dense table indexed by bunch number, the
+// FC-U tree is streamed in column batches, read basket by basket, and every
+// hit is dispatched through a detector table indexed by detn (cut, calibration,
+// selected-run flag and target histogram for dedicated/parasitic bunches)
+// instead of per-detector branches.
+// Each batch is first joined to PKUP (tof - tflash of every hit), then
+// filled; the same fill runs on the skim of a run (SortRunSkim), where the
+// join is stored. The friend-tree + BuildIndex loop of the original macro is
+// kept as SortRunFriendIndex() to compare results and speed.
+// The event loops take optional stage timers (see StageTimers.h).
+
+#include "TBranch.h"
+#include "TBufferFile.h"
+#include "TH1D.h"
+#include "TLeaf.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "SkimFormat.h"
+#include "StageTimers.h"
+
+// detectors of FC-U used in the transmission analysis
+const int kNDetectors = 6;
+const int kDetectors[kNDetectors] = {1, 2, 3, 4, 7, 8};
+
+// sets of runs: Sample-in and Sample-out
+const int kNSets = 2;
+const int kSin = 0;
+const int kSout = 1;
+const char *const kSetNames[kNSets] = {"Sin", "Sout"};
+
+// bunch types, indexed by PSpulse - 2
+const int kNBunchTypes = 2;
+const int kDedicated = 0; // PSpulse == 2
+const int kParasitic = 1; // PSpulse == 3
+const char *const kBunchNames[kNBunchTypes] = {"dedicated", "parasitic"};
+
+// detn is a small integer: the detector table is indexed directly by it
+const int kMaxDetn = 16;
+
+// number of FC-U entries read per column batch
+const Long64_t kColumnBatch = 8192;
+
+// minimum tof - tflash accepted (ns)
+const double kMinTof = 1000.;
+
+// size of the read-ahead cache (TTreeCache) of each tree
+const Long64_t kTreeCacheSize = 32 * 1024 * 1024;
+
+// branches read from the run files
+const char *const kPkupBranches[] = {"tflash", "BunchNumber", "PulseIntensity",
+                                     "PSpulse"};
+const char *const kFcuBranches[] = {"detn", "tof", "amp", "BunchNumber",
+                                    "PSpulse"};
+
+// map PSpulse to the bunch type index, -1 for other pulse types
+inline int BunchType(int PSpulse) {
+  return (PSpulse == 2) ? kDedicated : (PSpulse == 3) ? kParasitic : -1;
+}
+
+// one entry of the detector table
+struct DetectorSlot {
+  bool selected = false; // current run is in the run list of this detector
+  float cut = 0;         // amplitude threshold
+  float cal = 0;         // calibration offset added to tof - tflash
+  TH1D *hist[kNBunchTypes] = {nullptr, nullptr}; // target histograms
+  double *pi[kNBunchTypes] = {nullptr, nullptr}; // pulse intensity sums
+  // per-run histograms filled whatever the run selection (see PartialStore.h)
+  TH1D *partial[kNBunchTypes] = {nullptr, nullptr};
+
+  bool active() const { return selected || partial[kDedicated]; }
+
+  void fill(int type, double x) const {
+    if (selected)
+      hist[type]->Fill(x);
+    if (partial[type])
+      partial[type]->Fill(x);
+  }
+};
+
+struct DetectorTable {
+  DetectorSlot slot[kMaxDetn];
+  // pulse intensity of the run for each bunch type, whatever the selection
+  double *run_pi[kNBunchTypes] = {nullptr, nullptr};
+  // pulse intensities of the PKUP entries of the run for each bunch type, in
+  // tree order, if kept (float normalisation of the original macro)
+  std::vector<float> *pulses[kNBunchTypes] = {nullptr, nullptr};
+
+  const DetectorSlot *find(int detn) const {
+    if (detn < 0 || detn >= kMaxDetn || !slot[detn].active())
+      return nullptr;
+    return &slot[detn];
+  }
+};
+
+// PKUP tree stored as dense columns indexed by bunch number
+struct PkupTable {
+  std::vector<double> tflash;
+  std::vector<float> intensity;
+  std::vector<int> PSpulse;
+  std::vector<char> valid;
+
+  void clear() {
+    tflash.clear();
+    intensity.clear();
+    PSpulse.clear();
+    valid.clear();
+  }
+
+  bool has(int bunch) const {
+    return bunch >= 0 && bunch < (int)valid.size() && valid[bunch];
+  }
+
+  // keep the first PKUP entry of each bunch number
+  void insert(int bunch, double tf, float pi, int ps) {
+    if (bunch < 0)
+      return;
+    if (bunch >= (int)valid.size()) {
+      size_t n = std::max<size_t>(bunch + 1, 2 * valid.size());
+      tflash.resize(n, 0.);
+      intensity.resize(n, 0.f);
+      PSpulse.resize(n, 0);
+      valid.resize(n, 0);
+    }
+    if (valid[bunch])
+      return;
+    tflash[bunch] = tf;
+    intensity[bunch] = pi;
+    PSpulse[bunch] = ps;
+    valid[bunch] = 1;
+  }
+};
+
+// counters of a sorted run
+struct RunStats {
+  Long64_t entries = 0; // FC-U entries read
+  Long64_t matched = 0; // entries whose bunch is found in PKUP
+  double seconds = 0;   // real time spent in the event loop
+
+  RunStats &operator+=(const RunStats &o) {
+    entries += o.entries;
+    matched += o.matched;
+    seconds += o.seconds;
+    return *this;
+  }
+
+  double rate() const { return seconds > 0 ? entries / seconds : 0.; }
+};
+
+// add the pulse intensity of one PKUP entry to the selected detectors
+inline void AddPulseIntensity(const DetectorTable &table, int PSpulse,
+                              float PulseIntensity) {
+  int type = BunchType(PSpulse);
+  if (type < 0)
+    return;
+  for (int d = 0; d < kNDetectors; ++d) {
+    const DetectorSlot &s = table.slot[kDetectors[d]];
+    if (s.selected)
+      *s.pi[type] += PulseIntensity;
+  }
+  if (table.run_pi[type])
+    *table.run_pi[type] += PulseIntensity;
+  if (table.pulses[type])
+    table.pulses[type]->push_back(PulseIntensity);
+}
+
+// enable only the needed branches and read them through the read-ahead cache
+template <size_t N>
+void SetReadBranches(TTree *t, const char *const (&branches)[N]) {
+  t->SetBranchStatus("*", 0);
+  t->SetCacheSize(kTreeCacheSize);
+  for (size_t i = 0; i < N; ++i) {
+    t->SetBranchStatus(branches[i], 1);
+    t->AddBranchToCache(branches[i], kTRUE);
+  }
+  t->StopCacheLearningPhase();
+}
+
+// PKUP entries as read from the tree, in tree order
+struct PkupColumns {
+  std::vector<int> BunchNumber;
+  std::vector<int> PSpulse;
+  std::vector<float> PulseIntensity;
+  std::vector<double> tflash;
+};
+
+// read the PKUP tree once: fill the bunch table and the pulse intensity sums,
+// and optionally keep all the entries
+inline void ReadPkupTable(TTree *t_pkup, const DetectorTable &table,
+                          PkupTable &pk, PkupColumns *entries = nullptr) {
+  double tflash;
+  int BunchNumber, PSpulse;
+  float PulseIntensity;
+
+  SetReadBranches(t_pkup, kPkupBranches);
+
+  t_pkup->SetBranchAddress("tflash", &tflash);
+  t_pkup->SetBranchAddress("BunchNumber", &BunchNumber);
+  t_pkup->SetBranchAddress("PulseIntensity", &PulseIntensity);
+  t_pkup->SetBranchAddress("PSpulse", &PSpulse);
+
+  Long64_t nentryPK = t_pkup->GetEntriesFast();
+  if (nentryPK < 0)
+    nentryPK = t_pkup->GetEntries();
+
+  pk.clear();
+  for (Long64_t iP = 0; iP < nentryPK; ++iP) {
+    t_pkup->GetEntry(iP);
+    AddPulseIntensity(table, PSpulse, PulseIntensity);
+    pk.insert(BunchNumber, tflash, PulseIntensity, PSpulse);
+    if (entries) {
+      entries->BunchNumber.push_back(BunchNumber);
+      entries->PSpulse.push_back(PSpulse);
+      entries->PulseIntensity.push_back(PulseIntensity);
+      entries->tflash.push_back(tflash);
+    }
+  }
+
+  t_pkup->ResetBranchAddresses();
+}
+
+// One FC-U column read a whole basket at a time through the bulk API
+// (TBranch::GetBulkRead), which deserializes the basket into buf in one call.
+// Branches the bulk API does not support (not a single leaf of type T) are
+// read entry by entry.
+template <class T> class BulkColumn {
+private:
+  TBranch *b = nullptr;
+  T value;
+  TBufferFile buf{TBuffer::kWrite, 32 * 1024};
+  Long64_t basket_first = 0; // entries of the basket held by buf
+  Long64_t basket_n = 0;
+  bool bulk = false;
+
+public:
+  void init(TTree *t, const char *name) {
+    b = t->GetBranch(name);
+    b->SetAddress(&value);
+    TObjArray *leaves = b->GetListOfLeaves();
+    bulk = b->SupportsBulkRead() && leaves->GetEntriesFast() == 1 &&
+           ((TLeaf *)leaves->At(0))->GetLenType() == (Int_t)sizeof(T);
+  }
+
+  // read the entries [first, first + n) into col
+  void read(Long64_t first, Long64_t n, T *col) {
+    Long64_t i = 0;
+    while (bulk && i < n) {
+      Long64_t entry = first + i;
+      if (entry < basket_first || entry >= basket_first + basket_n) {
+        Int_t count = b->GetBulkRead().GetBulkEntries(entry, buf);
+        if (count <= 0) {
+          bulk = false; // read the rest entry by entry
+          break;
+        }
+        // buf starts at the first entry of the basket holding entry
+        basket_first = b->GetBasketEntry()[b->GetReadBasket()];
+        basket_n = count;
+      }
+      const T *data = reinterpret_cast<const T *>(buf.GetCurrent());
+      Long64_t m = std::min(n - i, basket_first + basket_n - entry);
+      std::copy(data + (entry - basket_first),
+                data + (entry - basket_first) + m, col + i);
+      i += m;
+    }
+    for (; i < n; ++i) {
+      b->GetEntry(first + i);
+      col[i] = value;
+    }
+  }
+};
+
+// Reads the FC-U columns used by the analysis in batches of kColumnBatch
+// entries, each column from whole baskets (see BulkColumn).
+class FcuBatchReader {
+private:
+  TTree *t;
+  BulkColumn<int> c_detn, c_bunch, c_pspulse;
+  BulkColumn<double> c_tof;
+  BulkColumn<float> c_amp;
+  Long64_t nentry;
+  Long64_t first = 0;
+
+public:
+  std::vector<int> detn, BunchNumber, PSpulse;
+  std::vector<double> tof;
+  std::vector<float> amp;
+
+  FcuBatchReader(TTree *t_fcu)
+      : t(t_fcu), detn(kColumnBatch), BunchNumber(kColumnBatch),
+        PSpulse(kColumnBatch), tof(kColumnBatch), amp(kColumnBatch) {
+    SetReadBranches(t, kFcuBranches);
+
+    c_detn.init(t, "detn");
+    c_tof.init(t, "tof");
+    c_amp.init(t, "amp");
+    c_bunch.init(t, "BunchNumber");
+    c_pspulse.init(t, "PSpulse");
+
+    nentry = t->GetEntriesFast();
+    if (nentry < 0)
+      nentry = t->GetEntries();
+  }
+
+  ~FcuBatchReader() { t->ResetBranchAddresses(); }
+
+  Long64_t entries() const { return nentry; }
+
+  // read the next batch; returns its size, 0 at the end of the tree
+  Long64_t next() {
+    Long64_t n = std::min(kColumnBatch, nentry - first);
+    if (n <= 0)
+      return 0;
+    c_detn.read(first, n, detn.data());
+    c_bunch.read(first, n, BunchNumber.data());
+    c_amp.read(first, n, amp.data());
+    c_tof.read(first, n, tof.data());
+    c_pspulse.read(first, n, PSpulse.data());
+    first += n;
+    return n;
+  }
+};
+
+// tof - tflash of a batch of FC-U hits, NaN for the hits whose bunch is not in
+// PKUP
+inline void JoinBatch(const PkupTable &pk, Long64_t n, const double *tof,
+                      const int *BunchNumber, double *dt) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (Long64_t i = 0; i < n; ++i)
+    dt[i] = pk.has(BunchNumber[i]) ? tof[i] - pk.tflash[BunchNumber[i]] : nan;
+}
+
+// fill the histograms with a batch of joined FC-U hits
+template <class D, class P>
+inline void FillBatch(const DetectorTable &table, Long64_t n, const D *detn,
+                      const double *dt, const float *amp, const P *PSpulse,
+                      RunStats &stats) {
+  for (Long64_t i = 0; i < n; ++i) {
+    if (std::isnan(dt[i]))
+      continue;
+    stats.matched += 1;
+
+    const DetectorSlot *s = table.find(detn[i]);
+    if (!s || !(amp[i] > s->cut) || dt[i] < kMinTof)
+      continue;
+
+    int type = BunchType(PSpulse[i]);
+    if (type >= 0)
+      s->fill(type, dt[i] + s->cal);
+  }
+}
+
+// columnar event loop over one run
+inline RunStats SortRunColumnar(TTree *t_pkup, TTree *t_fcu,
+                                const DetectorTable &table,
+                                StageTimes *stages = nullptr) {
+  RunStats stats;
+  PkupTable pk;
+  StageTimer pkup_timer(stages, kStagePkup);
+  ReadPkupTable(t_pkup, table, pk);
+  pkup_timer.stop();
+
+  TStopwatch timer;
+
+  FcuBatchReader batch(t_fcu);
+  std::vector<double> dt(kColumnBatch);
+  for (;;) {
+    StageTimer read_timer(stages, kStageLoop);
+    Long64_t n = batch.next();
+    read_timer.stop();
+    if (n == 0)
+      break;
+
+    StageTimer join_timer(stages, kStageJoin);
+    JoinBatch(pk, n, batch.tof.data(), batch.BunchNumber.data(), dt.data());
+    join_timer.stop();
+
+    StageTimer fill_timer(stages, kStageLoop);
+    FillBatch(table, n, batch.detn.data(), dt.data(), batch.amp.data(),
+              batch.PSpulse.data(), stats);
+  }
+
+  stats.entries = batch.entries();
+  stats.seconds = timer.RealTime();
+  return stats;
+}
+
+// event loop over the skim of a run (see SkimFormat.h). tof - tflash is
+// stored in the skim, NaN for the hits whose bunch is not in PKUP.
+inline RunStats SortRunSkim(const SkimFile &skim, const DetectorTable &table,
+                            StageTimes *stages = nullptr) {
+  RunStats stats;
+  const SkimHeader &h = skim.header();
+
+  StageTimer pkup_timer(stages, kStagePkup);
+  const int32_t *pk_PSpulse = skim.pk_PSpulse();
+  const float *pk_intensity = skim.pk_intensity();
+  for (uint64_t iP = 0; iP < h.n_pkup; ++iP)
+    AddPulseIntensity(table, pk_PSpulse[iP], pk_intensity[iP]);
+  pkup_timer.stop();
+
+  TStopwatch timer;
+  StageTimer loop_timer(stages, kStageLoop);
+
+  FillBatch(table, h.n_hits, skim.detn(), skim.dt(), skim.amp(),
+            skim.PSpulse(), stats);
+
+  loop_timer.stop();
+  stats.entries = h.n_hits;
+  stats.seconds = timer.RealTime();
+  return stats;
+}
+
+// original event loop: PKUP attached as an indexed friend of FC-U
+inline RunStats SortRunFriendIndex(TTree *t_pkup, TTree *t_fcu,
+                                   const DetectorTable &table,
+                                   StageTimes *stages = nullptr) {
+  RunStats stats;
+  StageTimer pkup_timer(stages, kStagePkup);
+
+  int detn, BunchNumber, BunchNumberPK, PSpulse, PSpulsePK;
+  double tof, tflash_p;
+  float amp, PulseIntensity, PulseIntensityPK;
+
+  t_pkup->SetBranchStatus("*", 0);
+  t_pkup->SetBranchStatus("tflash", 1);
+  t_pkup->SetBranchStatus("BunchNumber", 1);
+  t_pkup->SetBranchStatus("PulseIntensity", 1);
+  t_pkup->SetBranchStatus("PSpulse", 1);
+
+  t_pkup->SetBranchAddress("tflash", &tflash_p);
+  t_pkup->SetBranchAddress("BunchNumber", &BunchNumberPK);
+  t_pkup->SetBranchAddress("PulseIntensity", &PulseIntensityPK);
+  t_pkup->SetBranchAddress("PSpulse", &PSpulsePK);
+
+  Long64_t nentryPK = t_pkup->GetEntriesFast();
+  if (nentryPK < 0)
+    nentryPK = t_pkup->GetEntries();
+
+  for (Long64_t iP = 0; iP < nentryPK; ++iP) {
+    t_pkup->GetEntry(iP);
+    AddPulseIntensity(table, PSpulsePK, PulseIntensityPK);
+  }
+  pkup_timer.stop();
+
+  TStopwatch timer;
+
+  t_fcu->SetBranchStatus("*", 0);
+  t_fcu->SetBranchStatus("detn", 1);
+  t_fcu->SetBranchStatus("tof", 1);
+  t_fcu->SetBranchStatus("amp", 1);
+  t_fcu->SetBranchStatus("BunchNumber", 1);
+  t_fcu->SetBranchStatus("PulseIntensity", 1);
+  t_fcu->SetBranchStatus("PSpulse", 1);
+
+  t_fcu->SetBranchAddress("detn", &detn);
+  t_fcu->SetBranchAddress("tof", &tof);
+  t_fcu->SetBranchAddress("amp", &amp);
+  t_fcu->SetBranchAddress("BunchNumber", &BunchNumber);
+  t_fcu->SetBranchAddress("PulseIntensity", &PulseIntensity);
+  t_fcu->SetBranchAddress("PSpulse", &PSpulse);
+
+  // this method allows to read the 2 trees in parallel
+  StageTimer index_timer(stages, kStageJoin);
+  t_fcu->AddFriend(t_pkup);
+  t_pkup->BuildIndex("BunchNumber");
+  index_timer.stop();
+  StageTimer loop_timer(stages, kStageLoop);
+
+  Long64_t nentry = t_fcu->GetEntriesFast();
+  if (nentry < 0)
+    nentry = t_fcu->GetEntries();
+
+  for (Long64_t i = 0; i < nentry; ++i) {
+    t_fcu->GetEntry(i);
+
+    if (BunchNumberPK != BunchNumber)
+      continue;
+    stats.matched += 1;
+
+    const DetectorSlot *s = table.find(detn);
+    if (s && (amp > s->cut) && (tof - tflash_p >= kMinTof)) {
+      int type = BunchType(PSpulse);
+      if (type >= 0)
+        s->fill(type, tof - tflash_p + s->cal);
+    }
+  }
+
+  loop_timer.stop();
+  t_fcu->RemoveFriend(t_pkup);
+  t_fcu->ResetBranchAddresses();
+  t_pkup->ResetBranchAddresses();
+
+  stats.entries = nentry;
+  stats.seconds = timer.RealTime();
+  return stats;
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef TRANSMISSIONOUTPUT_H
+#define TRANSMISSIONOUTPUT_H
+
+// Run selection, binning and final output of the transmission analysis,
+// shared by Transmission_final.C (direct sorting), Transmission_merge.C (sum of
+// the per-run partial results), Transmission_online.C and
+// Transmission_resampling.C.
+
+#include "TCanvas.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include <cmath>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../config/ConfigReader.h"
+#include "PartialStore.h"
+#include "TransmissionEngine.h"
+
+// Run lists and sorting parameters of a cmnd file
+struct RunSelection {
+  std::vector<int> runs[kNSets];                     // SIN, SOUT
+  std::vector<int> lists[kNSets][kNDetectors];       // Sin_DET*, Sout_DET*
+  std::unordered_set<int> sets[kNSets][kNDetectors]; // the same, for lookups
+  std::string partial_dir; // per-run partial results (none if empty)
+  PartialParams params;    // their fine grid, amplitude cuts and calibrations
+
+  // run in the list of detector d of set s
+  bool in(int s, int d, int run) const { return sets[s][d].count(run) > 0; }
+
+  // run in the list of any detector of set s
+  bool used(int s, int run) const {
+    for (int d = 0; d < kNDetectors; ++d)
+      if (in(s, d, run))
+        return true;
+    return false;
+  }
+};
+
+inline RunSelection ReadRunSelection(ConfigReader &cfg) {
+  RunSelection sel;
+  sel.runs[kSin] = cfg.getIntVector("SIN");
+  sel.runs[kSout] = cfg.getIntVector("SOUT");
+  sel.partial_dir = cfg.getString("partial_dir");
+  sel.params.bins_per_decade = cfg.getInt("partial_bins_per_decade", 2000);
+
+  // for each detector: run lists, amplitude threshold and calibration value
+  for (int d = 0; d < kNDetectors; ++d) {
+    int det = kDetectors[d];
+    for (int s = 0; s < kNSets; ++s) {
+      sel.lists[s][d] = cfg.getIntVector(Form("%s_DET%d", kSetNames[s], det));
+      sel.sets[s][d] = std::unordered_set<int>(sel.lists[s][d].begin(),
+                                               sel.lists[s][d].end());
+    }
+    sel.params.cut[d] = cfg.getFloat(Form("cut_a_%d", det), 1.0f);
+    sel.params.cal[d] = cfg.getFloat(Form("cal_%d", det), 1.0f);
+  }
+  return sel;
+}
+
+// Number of fine bins of the partial results in a bin of BinPerDecade bins per
+// decade. Returns 0, with the reason in error, if there are no partial results
+// or if BinPerDecade does not divide their binning.
+inline int PartialGroup(const RunSelection &sel, int BinPerDecade,
+                        std::string &error) {
+  int partial_bins = sel.params.bins_per_decade;
+  if (sel.partial_dir.empty()) {
+    error = "partial_dir is not set";
+    return 0;
+  }
+  if (BinPerDecade <= 0 || partial_bins % BinPerDecade != 0) {
+    error = Form("%d bins per decade do not divide the %d bins per decade of "
+                 "the partial results",
+                 BinPerDecade, partial_bins);
+    return 0;
+  }
+  return partial_bins / BinPerDecade;
+}
+
+// Read the partial results of the selected runs, set by set in the order of the
+// SIN and SOUT lists (as Transmission_final.C sums them), and call
+// fn(s, run, H, PI) for each one; the histograms are deleted afterwards. Runs
+// in no detector list of their set are not read, runs without a partial result
+// are added to skipped. Returns false, with the reason in error, at the first
+// partial result that is invalid or was sorted with other cuts or calibrations.
+template <class F>
+bool LoadPartials(const RunSelection &sel, std::vector<int> &skipped,
+                  std::string &error, F fn) {
+  for (int s = 0; s < kNSets; ++s) {
+    for (int run : sel.runs[s]) {
+      if (!sel.used(s, run))
+        continue;
+
+      TH1D *H[kNDetectors][kNBunchTypes];
+      double PI[kNBunchTypes];
+      std::string reason;
+      if (!ReadPartial(PartialPath(sel.partial_dir, run), sel.params, H, PI,
+                       reason)) {
+        if (reason != "missing") {
+          error = Form("partial result of run %d: %s", run, reason.c_str());
+          return false;
+        }
+        skipped.push_back(run);
+        continue;
+      }
+
+      fn(s, run, H, PI);
+      for (int d = 0; d < kNDetectors; ++d)
+        for (int b = 0; b < kNBunchTypes; ++b)
+          delete H[d][b];
+    }
+  }
+  return true;
+}
+
+// number of decades of the tof histograms, starting at 1 ns
+const int kTofDecades = 8;
+
+// logaritmic binning of the tof histograms: kTofDecades * BinPerDecade bins
+inline std::vector<double> TofBinning(int BinPerDecade) {
+  int n_vec_tof = BinPerDecade * kTofDecades;
+  std::vector<double> xbins_tof(n_vec_tof + 1);
+  double step_tof = (double)kTofDecades / n_vec_tof;
+  for (int filler = 0; filler <= n_vec_tof; ++filler)
+    xbins_tof[filler] = (double)pow(10., step_tof * (double)filler);
+  return xbins_tof;
+}
+
+// Normalize each histogram for the corresponding number of protons (the
+// histograms are scaled in place), perform the transmission ratios separately
+// for each detector and bunch type and average the 12 transmissions.
+// With float_norm the factors 1 / PI are computed in float, as the original
+// macro did with its float sums.
+inline TH1D *
+TotalTransmission(TH1D *HS[kNSets][kNDetectors][kNBunchTypes],
+                  const double PI_S[kNSets][kNDetectors][kNBunchTypes],
+                  const std::vector<double> &xbins_tof,
+                  const char *name = "Total transmission",
+                  bool float_norm = false) {
+  for (int s = 0; s < kNSets; ++s) {
+    for (int d = 0; d < kNDetectors; ++d) {
+      for (int b = 0; b < kNBunchTypes; ++b) {
+        double norm = float_norm ? 1 / (float)PI_S[s][d][b] : 1 / PI_S[s][d][b];
+        HS[s][d][b]->Scale(norm);
+      }
+    }
+  }
+
+  TH1D *HTransm_final =
+      new TH1D(name, "", xbins_tof.size() - 1, xbins_tof.data());
+  HTransm_final->Sumw2();
+  HTransm_final->SetTitle("Total transmission");
+  HTransm_final->GetXaxis()->SetTitle("ToF - Tpkup + #Delta (ns)");
+
+  const char *bunch_tag[kNBunchTypes] = {"dedi", "para"};
+  for (int b = 0; b < kNBunchTypes; ++b) {
+    for (int d = 0; d < kNDetectors; ++d) {
+      TH1D *HT = (TH1D *)HS[kSin][d][b]->Clone(
+          Form("HT_%d_%s", kDetectors[d], bunch_tag[b]));
+      HT->Divide(HS[kSout][d][b]);
+      HTransm_final->Add(HT);
+      delete HT;
+    }
+  }
+
+  HTransm_final->Scale(1 / 12.0);
+  return HTransm_final;
+}
+
+// default directory of the total transmission
+const char *const kTotalDir = "./OUTPUT/Transmission/Total";
+
+inline std::string TotalTransmissionPath(int BinPerDecade,
+                                         const std::string &dir = kTotalDir) {
+  return Form("%s/Transmission_total_%dbin.root", dir.c_str(), BinPerDecade);
+}
+
+// draw the total transmission and save it in dir (OUTPUT/Transmission/Total by
+// default); the histogram is also written at the top level of the file
+inline void SaveTotalTransmission(TH1D *HTransm_final, int BinPerDecade,
+                                  const std::string &dir = kTotalDir) {
+  int xmin_plot = 1e3;
+  HTransm_final->GetXaxis()->SetRangeUser(xmin_plot, 1e8);
+
+  TCanvas *c_Transm_final =
+      new TCanvas("C_Transm_final", "Canvas Transm final", 2400, 1700);
+  HTransm_final->Draw("HIST");
+  c_Transm_final->SetLogx();
+  // c_Transm_final->SaveAs(Form("./OUTPUT/Transmission/Total/Transmission_total_%dbin.png",BinPerDecade));
+  std::string path = TotalTransmissionPath(BinPerDecade, dir);
+  c_Transm_final->SaveAs(path.c_str());
+
+  TFile *f = TFile::Open(path.c_str(), "UPDATE");
+  if (f && !f->IsZombie())
+    f->WriteTObject(HTransm_final);
+  delete f;
+}
+
+// Total transmission saved by SaveTotalTransmission in dir (nullptr if
+// missing). Files written before the histogram was saved at the top level are
+// read from the canvas.
+inline TH1D *LoadTotalTransmission(int BinPerDecade,
+                                   const std::string &dir = kTotalDir) {
+  TFile *f =
+      TFile::Open(TotalTransmissionPath(BinPerDecade, dir).c_str(), "READ");
+  if (!f || f->IsZombie()) {
+    delete f;
+    return nullptr;
+  }
+  TH1D *h = (TH1D *)f->Get("Total transmission");
+  if (!h) {
+    TCanvas *c = (TCanvas *)f->Get("C_Transm_final");
+    if (c)
+      h = (TH1D *)c->GetListOfPrimitives()->FindObject("Total transmission");
+  }
+  if (h) {
+    h = (TH1D *)h->Clone("Total transmission");
+    h->SetDirectory(nullptr);
+  }
+  delete f;
+  return h;
+}
+
+#endif
@@ -1,10 +1,135 @@
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
 #include "ConfigReader.h"
+#include "../analysis/AmplitudeSpectra.h"
 
 namespace py = pybind11;
 
+// numpy arrays holding the amplitude spectra of n_runs runs
+struct SpectraArrays {
+    py::array_t<double> uncut, cut, max_bin, pulse_intensity;
+    py::array_t<int64_t> entries, entries_cut;
+
+    SpectraArrays(size_t n_runs, const AmplitudeBinning &ab)
+        : uncut({n_runs, (size_t)ab.ndet(), (size_t)ab.size()}),
+          cut({n_runs, (size_t)ab.ndet(), (size_t)ab.size()}),
+          max_bin({n_runs, (size_t)ab.ndet()}),
+          pulse_intensity(n_runs),
+          entries({n_runs, (size_t)ab.ndet()}),
+          entries_cut({n_runs, (size_t)ab.ndet()})
+    {
+        std::memset(uncut.mutable_data(), 0, uncut.nbytes());
+        std::memset(cut.mutable_data(), 0, cut.nbytes());
+    }
+
+    // pointers to the results of one run
+    AmplitudeRun run(size_t r, const AmplitudeBinning &ab)
+    {
+        size_t nd = ab.ndet(), size = nd * ab.size();
+        AmplitudeRun out;
+        out.uncut = uncut.mutable_data() + r * size;
+        out.cut = cut.mutable_data() + r * size;
+        out.entries = entries.mutable_data() + r * nd;
+        out.entries_cut = entries_cut.mutable_data() + r * nd;
+        out.max_bin = max_bin.mutable_data() + r * nd;
+        out.pulse_intensity = pulse_intensity.mutable_data() + r;
+        return out;
+    }
+
+    py::dict to_dict() const
+    {
+        py::dict d;
+        d["uncut"] = uncut;
+        d["cut"] = cut;
+        d["entries"] = entries;
+        d["entries_cut"] = entries_cut;
+        d["max_bin"] = max_bin;
+        d["pulse_intensity"] = pulse_intensity;
+        return d;
+    }
+};
+
+// Check the binning of the spectra before it reaches the kernel: a zero,
+// negative or infinite bin width would give inf/NaN bin positions, and their
+// conversion to int is undefined.
+void check_binning(const std::vector<int> &detectors,
+                   const std::vector<float> &cuts, int nbins, double amp_max)
+{
+    if (cuts.size() != detectors.size())
+        throw std::invalid_argument("one cut per detector is needed");
+    if (nbins <= 0 || nbins > std::numeric_limits<int>::max() - 2)
+        throw std::invalid_argument("nbins must be positive");
+    if (!(std::isfinite(amp_max) && amp_max > 0.))
+        throw std::invalid_argument("amp_max must be finite and above 0, the lower edge");
+}
+
+// spectra of the runs of a list of skims, processed in parallel; the time of
+// each stage is added to stages if given
+py::dict amplitude_spectra(const std::vector<std::string> &skim_paths,
+                           const std::vector<int> &detectors,
+                           const std::vector<float> &cuts, int nbins,
+                           double amp_max, int jobs, StageTimes *stages)
+{
+    check_binning(detectors, cuts, nbins, amp_max);
+
+    AmplitudeBinning ab(nbins, amp_max, detectors, cuts);
+    SpectraArrays arrays(skim_paths.size(), ab);
+    std::vector<AmplitudeRun> out;
+    for (size_t r = 0; r < skim_paths.size(); ++r)
+        out.push_back(arrays.run(r, ab));
+
+    std::vector<std::string> errors(skim_paths.size());
+    std::vector<StageTimes> run_stages(skim_paths.size());
+    {
+        py::gil_scoped_release release;
+        int n_jobs = NumberOfJobs(jobs, skim_paths.size());
+        RunPool(skim_paths.size(), n_jobs, [&](size_t r, int) {
+            AmplitudeSpectraSkim(ab, skim_paths[r], 1, out[r], errors[r],
+                                 stages ? &run_stages[r] : nullptr);
+        });
+    }
+    if (stages)
+        for (const StageTimes &t : run_stages)
+            *stages += t;
+    for (const std::string &error : errors)
+        if (!error.empty())
+            throw std::runtime_error(error);
+
+    return arrays.to_dict();
+}
+
+// spectra of one run from its detn and amp columns, split among the jobs
+py::dict amplitude_spectra_arrays(
+    py::array_t<int32_t, py::array::c_style | py::array::forcecast> detn,
+    py::array_t<float, py::array::c_style | py::array::forcecast> amp,
+    double pulse_intensity, const std::vector<int> &detectors,
+    const std::vector<float> &cuts, int nbins, double amp_max, int jobs,
+    StageTimes *stages)
+{
+    check_binning(detectors, cuts, nbins, amp_max);
+    if (detn.size() != amp.size())
+        throw std::invalid_argument("detn and amp must have the same length");
+
+    AmplitudeBinning ab(nbins, amp_max, detectors, cuts);
+    SpectraArrays arrays(1, ab);
+    AmplitudeRun out = arrays.run(0, ab);
+    *out.pulse_intensity = pulse_intensity;
+    {
+        py::gil_scoped_release release;
+        AmplitudeSpectra(ab, detn.data(), amp.data(), detn.size(), jobs, out,
+                         stages);
+    }
+    return arrays.to_dict();
+}
+
 PYBIND11_MODULE(configreader_cpp, m) {
     m.doc() = "Python bindings for the C++ ConfigReader using pybind11";
 
@@ -19,4 +144,41 @@ PYBIND11_MODULE(configreader_cpp, m) {
         .def("get_float", &ConfigReader::getFloat,
              py::arg("key"), py::arg("default") = 0.0f)
         .def("get_int_vector", &ConfigReader::getIntVector, py::arg("key"));
+
+    // stage timers of analysis/StageTimers.h: StageTimer is a context manager
+    // adding its time to a StageTimes, or doing nothing if it is None
+    py::enum_<Stage>(m, "Stage")
+        .value("open", kStageOpen)
+        .value("pkup", kStagePkup)
+        .value("join", kStageJoin)
+        .value("loop", kStageLoop)
+        .value("merge", kStageMerge)
+        .value("write", kStageWrite);
+    py::class_<StageTimes>(m, "StageTimes")
+        .def(py::init<>())
+        .def("__str__", [](const StageTimes &t) {
+            std::ostringstream out;
+            t.print(out);
+            return out.str();
+        });
+    py::class_<StageTimer>(m, "StageTimer")
+        .def(py::init<StageTimes *, Stage>(), py::arg("stages").none(true),
+             py::arg("stage"), py::keep_alive<1, 2>())
+        .def("__enter__", [](StageTimer &t) -> StageTimer & { return t; },
+             py::return_value_policy::reference)
+        .def("__exit__", [](StageTimer &t, py::args) { t.stop(); });
+
+    m.def("amplitude_spectra", &amplitude_spectra,
+          "Amplitude spectra of all the detectors for a list of run skims "
+          "(see analysis/AmplitudeSpectra.h), one run per row",
+          py::arg("skim_paths"), py::arg("detectors"), py::arg("cuts"),
+          py::arg("nbins"), py::arg("amp_max") = 45.e3, py::arg("jobs") = 0,
+          py::arg("stages").none(true) = nullptr);
+    m.def("amplitude_spectra_arrays", &amplitude_spectra_arrays,
+          "Amplitude spectra of all the detectors for one run, from its detn "
+          "and amp columns",
+          py::arg("detn"), py::arg("amp"), py::arg("pulse_intensity"),
+          py::arg("detectors"), py::arg("cuts"), py::arg("nbins"),
+          py::arg("amp_max") = 45.e3, py::arg("jobs") = 0,
+          py::arg("stages").none(true) = nullptr);
 }
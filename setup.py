@@ -6,6 +6,10 @@ ext_modules = [
         "configreader_cpp",
         ["config/configreader_bindings.cpp"],
         cxx_std=17,
+        # amplitude spectra engine (analysis/AmplitudeSpectra.h): threads, and
+        # no FP traps so that the bin computation can be vectorized
+        extra_compile_args=["-O3", "-fno-trapping-math", "-pthread"],
+        extra_link_args=["-pthread"],
     )
 ]
 